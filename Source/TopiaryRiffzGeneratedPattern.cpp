@@ -0,0 +1,221 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TopiaryRiffzGeneratedPattern.h"
+
+TopiaryRiffzGeneratedPattern::TopiaryRiffzGeneratedPattern()
+{
+} // TopiaryRiffzGeneratedPattern
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzGeneratedPattern::~TopiaryRiffzGeneratedPattern()
+{
+} // ~TopiaryRiffzGeneratedPattern
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzGeneratedPattern::indexSourcePattern(const TopiaryPattern* source)
+{
+	// counting sort of the source events into eighths; O(number of events + number of eighths)
+	// message thread; also copies what regenerating an eighth needs from the source
+
+	const int ticksPerEighth = Topiary::TicksPerQuarter / 2;
+
+	numEighths = (source->patLenInTicks + ticksPerEighth - 1) / ticksPerEighth;
+	if (numEighths < 1)
+		numEighths = 1;
+
+	if (eighthCapacity < (numEighths + 1))
+	{
+		eighthCapacity = numEighths + 1;
+		eighthStart.realloc(eighthCapacity);
+	}
+
+	if (eventCapacity < source->numItems)
+	{
+		eventCapacity = source->numItems;
+		eighthEvents.realloc(eventCapacity);
+		sourceEvents.realloc(eventCapacity);
+	}
+
+	for (int i = 0; i < source->numItems; i++)
+	{
+		sourceEvents[i].timestamp = source->dataList[i].timestamp;
+		sourceEvents[i].midiType = source->dataList[i].midiType;
+		sourceEvents[i].note = source->dataList[i].note;
+		sourceEvents[i].length = source->dataList[i].length;
+		sourceEvents[i].velocity = source->dataList[i].velocity;
+		sourceEvents[i].value = source->dataList[i].value;
+	}
+	sourceLength = source->patLenInTicks;
+
+	humanizeBatch.ensureCapacity(source->numItems);	// here, so regenerating an eighth never allocates
+
+	eighthStart.clear(numEighths + 1);
+
+	// count; events outside the pattern length (should not happen) go in the first or last eighth
+	for (int i = 0; i < source->numItems; i++)
+	{
+		int e = jlimit(0, numEighths - 1, source->dataList[i].timestamp / ticksPerEighth);
+		eighthStart[e + 1]++;
+	}
+
+	for (int e = 0; e < numEighths; e++)
+		eighthStart[e + 1] += eighthStart[e];
+
+	// place; eighthStart[e] is used as running insert position, which keeps source order within an eighth
+	for (int i = 0; i < source->numItems; i++)
+	{
+		int e = jlimit(0, numEighths - 1, source->dataList[i].timestamp / ticksPerEighth);
+		eighthEvents[eighthStart[e]] = i;
+		eighthStart[e]++;
+	}
+
+	// eighthStart[e] now holds the end of bucket e; shift everything one up to get the starts back
+	for (int e = numEighths; e > 0; e--)
+		eighthStart[e] = eighthStart[e - 1];
+	eighthStart[0] = 0;
+
+} // indexSourcePattern
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzGeneratedPattern::getEighth(int eighth, const int*& sourceIndexes)
+{
+	if ((eighth < 0) || (eighth >= numEighths))
+	{
+		sourceIndexes = nullptr;
+		return 0;
+	}
+
+	sourceIndexes = eighthEvents.getData() + eighthStart[eighth];
+	return eighthStart[eighth + 1] - eighthStart[eighth];
+
+} // getEighth
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzGeneratedPattern::getNumEighths()
+{
+	return numEighths;
+
+} // getNumEighths
+
+/////////////////////////////////////////////////////////////////////////////
+
+const TopiaryRiffzGeneratedPattern::SourceEvent* TopiaryRiffzGeneratedPattern::getSourceEvents()
+{
+	return sourceEvents.getData();
+
+} // getSourceEvents
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzGeneratedPattern::getSourceLength()
+{
+	return sourceLength;
+
+} // getSourceLength
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzGeneratedPattern::ensureSlotCapacity(int n)
+{
+	if (slotCapacity < (n + 1))
+	{
+		slotCapacity = n + 1;
+		slotOfID.realloc(slotCapacity);
+	}
+
+} // ensureSlotCapacity
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzGeneratedPattern::resetSlots()
+{
+	ensureSlotCapacity(numItems);
+	for (int i = 0; i < numItems; i++)
+	{
+		jassert(dataList[i].ID == (i + 1));
+		slotOfID[i + 1] = i;
+	}
+
+} // resetSlots
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzGeneratedPattern::rebuildSlots()
+{
+	ensureSlotCapacity(numItems);
+	for (int i = 0; i < numItems; i++)
+	{
+		jassert((dataList[i].ID > 0) && (dataList[i].ID <= numItems));
+		slotOfID[dataList[i].ID] = i;
+	}
+
+} // rebuildSlots
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzGeneratedPattern::findSlot(int ID)
+{
+	jassert((ID > 0) && (ID <= numItems));
+	jassert(dataList[slotOfID[ID]].ID == ID); // slot map out of sync; someone reordered dataList behind our back
+
+	return slotOfID[ID];
+
+} // findSlot
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzGeneratedPattern::sortByTimestamp()
+{
+	// generated patterns are close to sorted: they follow the (sorted) source pattern, or the previous generation,
+	// and swing and timing randomization only move events by a bounded number of ticks
+	// a stable insertion sort is linear on that; if events turn out to be moved far, fall back to the full sort
+
+	const int maxShifts = 8 * numItems + 64;
+	int shifts = 0;
+
+	for (int i = 1; i < numItems; i++)
+	{
+		if (dataList[i - 1].timestamp <= dataList[i].timestamp)
+			continue;
+
+		auto item = dataList[i];
+		int j = i;
+		while ((j > 0) && (dataList[j - 1].timestamp > item.timestamp))
+		{
+			dataList[j] = dataList[j - 1];
+			j--;
+		}
+		dataList[j] = item;
+
+		shifts += i - j;
+		if (shifts > maxShifts)
+		{
+			TopiaryVariation::sortByTimestamp();
+			break;
+		}
+	}
+
+	rebuildSlots();
+
+} // sortByTimestamp
@@ -0,0 +1,85 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "TopiaryRiffz.h"
+#include "../Topiary/Source/Model/TopiaryPattern.h"
+#include "../Topiary/Source/Model/TopiaryVariation.h"
+#include "TopiaryRiffzHumanize.h"
+
+/*
+A TopiaryVariation as generated from a source pattern, plus the bookkeeping the generator needs
+to regenerate it piecewise. The eighth index groups the source events per eighth note, so that
+regenerating one eighth only visits the events in that eighth.
+The slot map replaces findID(): slotOfID[ID] is the index in dataList of the event with that ID. It is
+reset together with the IDs on a full regeneration and rebuilt after every sort, so it is always valid.
+The index is a snapshot of the source pattern at the last full regeneration; IDs in the generated
+pattern (source index + 1) refer to that same snapshot. The source events themselves are copied too,
+so regenerating an eighth (audio thread) never reads the source pattern the editor may be changing.
+*/
+
+class TopiaryRiffzGeneratedPattern : public TopiaryVariation
+{
+public:
+	TopiaryRiffzGeneratedPattern();
+	~TopiaryRiffzGeneratedPattern();
+
+	struct SourceEvent
+	{
+		int timestamp;
+		int midiType;
+		int note;
+		int length;		// for CC: the controller
+		int velocity;
+		int value;
+	};
+
+	void indexSourcePattern(const TopiaryPattern* source);		// (re)build the eighth index and the source snapshot; call on every full regeneration
+	int getEighth(int eighth, const int*& sourceIndexes);	// returns number of source events in this eighth, sourceIndexes points to them
+	int getNumEighths();
+	const SourceEvent* getSourceEvents();	// snapshot taken by indexSourcePattern, indexed like the source pattern
+	int getSourceLength();					// patLenInTicks of the source at that time
+
+	void resetSlots();						// IDs are 1..numItems in dataList order; call after setting them
+	int findSlot(int ID);					// O(1) replacement for findID()
+	void sortByTimestamp();					// sorts (linear when nearly sorted) and keeps the slot map valid
+
+	int renderIteration = 0;				// humanization stream: the render (or take) this pattern is
+	int loopIteration = 0;					// and the loops played since; see generateVariation
+	TopiaryRiffzHumanize::Batch humanizeBatch;	// scratch for the generator; sized on every full regeneration
+
+private:
+	HeapBlock<int> eighthStart;		// numEighths + 1 entries; events of eighth e are eighthEvents[eighthStart[e]] .. eighthEvents[eighthStart[e+1]-1]
+	HeapBlock<int> eighthEvents;	// source pattern indexes, grouped per eighth
+	int numEighths = 0;
+	int eighthCapacity = 0;
+	int eventCapacity = 0;
+
+	HeapBlock<SourceEvent> sourceEvents;	// eventCapacity entries
+	int sourceLength = 0;
+
+	HeapBlock<int> slotOfID;		// indexed by ID; slotOfID[0] unused
+	int slotCapacity = 0;
+
+	void rebuildSlots();
+	void ensureSlotCapacity(int n);
+
+	JUCE_DECLARE_NON_COPYABLE(TopiaryRiffzGeneratedPattern)
+
+}; // TopiaryRiffzGeneratedPattern
@@ -0,0 +1,336 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TopiaryRiffzHumanize.h"
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define RIFFZ_HUMANIZE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#include <emmintrin.h>
+	#define RIFFZ_HUMANIZE_SSE2
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzHumanize::Batch::ensureCapacity(int n)
+{
+	if (capacity >= n)
+		return;
+
+	capacity = n;
+	slot.realloc(capacity);
+	timestamp.realloc(capacity);
+	velocity.realloc(capacity);
+	length.realloc(capacity);
+	noteMask.realloc(capacity);
+	for (int d = DrawLengthDirection; d < drawsPerEvent; d++)
+		draw[d].realloc(capacity);
+
+} // ensureCapacity
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzHumanize::Batch::add(int s, int ts, int vel, int len, bool isNote, const float* draws)
+{
+	jassert(numEvents < capacity);
+
+	slot[numEvents] = s;
+	timestamp[numEvents] = ts;
+	velocity[numEvents] = vel;
+	length[numEvents] = len;
+	noteMask[numEvents] = isNote ? -1 : 0;
+	for (int d = DrawLengthDirection; d < drawsPerEvent; d++)
+		draw[d][numEvents] = draws[d];
+	numEvents++;
+
+} // add
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzHumanize::applyScalar(const Settings& settings, Batch& batch, int from, int to)
+{
+	// the reference; the SIMD versions below do exactly this, in the same float operation order
+
+	const int lastTick = settings.patLenInTicks - 1;
+
+	for (int i = from; i < to; i++)
+	{
+		bool isNote = (batch.noteMask[i] != 0);
+		int len = batch.length[i];
+
+		if (settings.length && isNote)
+		{
+			float direction;
+			if (settings.lengthPlus && settings.lengthMin)
+				direction = (batch.draw[DrawLengthDirection][i] > 0.5f) ? 1.0f : -1.0f;
+			else
+				direction = settings.lengthPlus ? 1.0f : -1.0f;
+
+			len = len + (int)(direction * batch.draw[DrawLength][i] * 128 * (float)len / 100);
+
+			if (len > lastTick)
+				len = lastTick;
+			else if (len < 0)
+				len = 1;
+		}
+
+		if (settings.velocity && isNote)
+		{
+			float direction;
+			if (settings.velocityPlus && settings.velocityMin)
+				direction = (batch.draw[DrawVelocityDirection][i] > 0.5f) ? 1.0f : -1.0f;
+			else
+				direction = settings.velocityPlus ? 1.0f : -1.0f;
+
+			int vel = batch.velocity[i];
+			vel = vel + (int)(direction * batch.draw[DrawVelocity][i] * 128 * (float)settings.velocityValue / 50);
+			vel = vel + settings.velocityValue;
+
+			if (vel > 127) vel = 127;
+			else if (vel < 0)
+				vel = 0;
+
+			batch.velocity[i] = vel;
+		}
+
+		if (settings.timing)
+		{
+			float direction;
+			if (settings.timingPlus && settings.timingMin)
+				direction = (batch.draw[DrawTimingDirection][i] > 0.5f) ? 1.0f : -1.0f;
+			else
+				direction = settings.timingPlus ? 1.0f : -1.0f;
+
+			int ts = batch.timestamp[i];
+			ts = ts + (int)(direction * batch.draw[DrawTiming][i] * Topiary::TicksPerQuarter * (float)settings.timingValue / 800);
+
+			if (ts < 0) ts = 0;
+			if (ts < settings.earliestTick) ts = settings.earliestTick;
+			if (ts > lastTick) ts = lastTick;	// lastTick because we need time for the note off event
+
+			batch.timestamp[i] = ts;
+
+			// make sure we do not run over the pattern length with the note off
+			if (isNote && ((len + ts) > lastTick))
+				len = lastTick - ts;
+		}
+
+		batch.length[i] = len;
+	}
+
+} // applyScalar
+
+/////////////////////////////////////////////////////////////////////////////
+
+#if defined(RIFFZ_HUMANIZE_AVX2)
+
+static inline __m256 humanizeDirection(bool plus, bool min, const float* directionDraws)
+{
+	if (plus && min)
+	{
+		__m256 up = _mm256_cmp_ps(_mm256_loadu_ps(directionDraws), _mm256_set1_ps(0.5f), _CMP_GT_OQ);
+		return _mm256_blendv_ps(_mm256_set1_ps(-1.0f), _mm256_set1_ps(1.0f), up);
+	}
+	return _mm256_set1_ps(plus ? 1.0f : -1.0f);
+
+} // humanizeDirection
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int humanizeSIMD(const TopiaryRiffzHumanize::Settings& settings, TopiaryRiffzHumanize::Batch& batch)
+{
+	typedef TopiaryRiffzHumanize H;
+
+	const int n = batch.numEvents & ~7;
+	const __m256i lastTick = _mm256_set1_epi32(settings.patLenInTicks - 1);
+	const __m256i earliest = _mm256_set1_epi32(jmax(0, settings.earliestTick));
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i maxVelocity = _mm256_set1_epi32(127);
+	const __m256i velocityValue = _mm256_set1_epi32(settings.velocityValue);
+	const __m256 f128 = _mm256_set1_ps(128.0f);
+	const __m256 velocityValueF = _mm256_set1_ps((float)settings.velocityValue);
+	const __m256 timingValueF = _mm256_set1_ps((float)settings.timingValue);
+	const __m256 ticksPerQuarter = _mm256_set1_ps((float)Topiary::TicksPerQuarter);
+
+	for (int i = 0; i < n; i += 8)
+	{
+		__m256i noteMask = _mm256_loadu_si256((const __m256i*) (batch.noteMask + i));
+		__m256i len = _mm256_loadu_si256((const __m256i*) (batch.length + i));
+
+		if (settings.length)
+		{
+			__m256 direction = humanizeDirection(settings.lengthPlus, settings.lengthMin, batch.draw[H::DrawLengthDirection] + i);
+			__m256 delta = _mm256_mul_ps(_mm256_mul_ps(direction, _mm256_loadu_ps(batch.draw[H::DrawLength] + i)), f128);
+			delta = _mm256_div_ps(_mm256_mul_ps(delta, _mm256_cvtepi32_ps(len)), _mm256_set1_ps(100.0f));
+
+			__m256i l = _mm256_add_epi32(len, _mm256_cvttps_epi32(delta));
+			l = _mm256_blendv_epi8(l, one, _mm256_cmpgt_epi32(zero, l));
+			l = _mm256_min_epi32(l, lastTick);
+			len = _mm256_blendv_epi8(len, l, noteMask);
+		}
+
+		if (settings.velocity)
+		{
+			__m256 direction = humanizeDirection(settings.velocityPlus, settings.velocityMin, batch.draw[H::DrawVelocityDirection] + i);
+			__m256 delta = _mm256_mul_ps(_mm256_mul_ps(direction, _mm256_loadu_ps(batch.draw[H::DrawVelocity] + i)), f128);
+			delta = _mm256_div_ps(_mm256_mul_ps(delta, velocityValueF), _mm256_set1_ps(50.0f));
+
+			__m256i vel = _mm256_loadu_si256((const __m256i*) (batch.velocity + i));
+			__m256i v = _mm256_add_epi32(_mm256_add_epi32(vel, _mm256_cvttps_epi32(delta)), velocityValue);
+			v = _mm256_max_epi32(_mm256_min_epi32(v, maxVelocity), zero);
+			_mm256_storeu_si256((__m256i*) (batch.velocity + i), _mm256_blendv_epi8(vel, v, noteMask));
+		}
+
+		if (settings.timing)
+		{
+			__m256 direction = humanizeDirection(settings.timingPlus, settings.timingMin, batch.draw[H::DrawTimingDirection] + i);
+			__m256 delta = _mm256_mul_ps(_mm256_mul_ps(direction, _mm256_loadu_ps(batch.draw[H::DrawTiming] + i)), ticksPerQuarter);
+			delta = _mm256_div_ps(_mm256_mul_ps(delta, timingValueF), _mm256_set1_ps(800.0f));
+
+			__m256i ts = _mm256_loadu_si256((const __m256i*) (batch.timestamp + i));
+			ts = _mm256_add_epi32(ts, _mm256_cvttps_epi32(delta));
+			ts = _mm256_min_epi32(_mm256_max_epi32(ts, earliest), lastTick);
+			_mm256_storeu_si256((__m256i*) (batch.timestamp + i), ts);
+
+			__m256i cut = _mm256_sub_epi32(lastTick, ts);
+			__m256i over = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_add_epi32(len, ts), lastTick), noteMask);
+			len = _mm256_blendv_epi8(len, cut, over);
+		}
+
+		_mm256_storeu_si256((__m256i*) (batch.length + i), len);
+	}
+
+	return n;
+
+} // humanizeSIMD
+
+#elif defined(RIFFZ_HUMANIZE_SSE2)
+
+// SSE2 has no blend and no 32 bit min/max; build them from compares
+
+static inline __m128i humanizeSelect(__m128i mask, __m128i a, __m128i b)	// mask ? a : b
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+
+} // humanizeSelect
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline __m128 humanizeDirection(bool plus, bool min, const float* directionDraws)
+{
+	if (plus && min)
+	{
+		__m128 up = _mm_cmpgt_ps(_mm_loadu_ps(directionDraws), _mm_set1_ps(0.5f));
+		return _mm_or_ps(_mm_and_ps(up, _mm_set1_ps(1.0f)), _mm_andnot_ps(up, _mm_set1_ps(-1.0f)));
+	}
+	return _mm_set1_ps(plus ? 1.0f : -1.0f);
+
+} // humanizeDirection
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int humanizeSIMD(const TopiaryRiffzHumanize::Settings& settings, TopiaryRiffzHumanize::Batch& batch)
+{
+	typedef TopiaryRiffzHumanize H;
+
+	const int n = batch.numEvents & ~3;
+	const __m128i lastTick = _mm_set1_epi32(settings.patLenInTicks - 1);
+	const __m128i earliest = _mm_set1_epi32(jmax(0, settings.earliestTick));
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i maxVelocity = _mm_set1_epi32(127);
+	const __m128i velocityValue = _mm_set1_epi32(settings.velocityValue);
+	const __m128 f128 = _mm_set1_ps(128.0f);
+	const __m128 velocityValueF = _mm_set1_ps((float)settings.velocityValue);
+	const __m128 timingValueF = _mm_set1_ps((float)settings.timingValue);
+	const __m128 ticksPerQuarter = _mm_set1_ps((float)Topiary::TicksPerQuarter);
+
+	for (int i = 0; i < n; i += 4)
+	{
+		__m128i noteMask = _mm_loadu_si128((const __m128i*) (batch.noteMask + i));
+		__m128i len = _mm_loadu_si128((const __m128i*) (batch.length + i));
+
+		if (settings.length)
+		{
+			__m128 direction = humanizeDirection(settings.lengthPlus, settings.lengthMin, batch.draw[H::DrawLengthDirection] + i);
+			__m128 delta = _mm_mul_ps(_mm_mul_ps(direction, _mm_loadu_ps(batch.draw[H::DrawLength] + i)), f128);
+			delta = _mm_div_ps(_mm_mul_ps(delta, _mm_cvtepi32_ps(len)), _mm_set1_ps(100.0f));
+
+			__m128i l = _mm_add_epi32(len, _mm_cvttps_epi32(delta));
+			l = humanizeSelect(_mm_cmpgt_epi32(zero, l), one, l);
+			l = humanizeSelect(_mm_cmpgt_epi32(l, lastTick), lastTick, l);
+			len = humanizeSelect(noteMask, l, len);
+		}
+
+		if (settings.velocity)
+		{
+			__m128 direction = humanizeDirection(settings.velocityPlus, settings.velocityMin, batch.draw[H::DrawVelocityDirection] + i);
+			__m128 delta = _mm_mul_ps(_mm_mul_ps(direction, _mm_loadu_ps(batch.draw[H::DrawVelocity] + i)), f128);
+			delta = _mm_div_ps(_mm_mul_ps(delta, velocityValueF), _mm_set1_ps(50.0f));
+
+			__m128i vel = _mm_loadu_si128((const __m128i*) (batch.velocity + i));
+			__m128i v = _mm_add_epi32(_mm_add_epi32(vel, _mm_cvttps_epi32(delta)), velocityValue);
+			v = humanizeSelect(_mm_cmpgt_epi32(v, maxVelocity), maxVelocity, v);
+			v = humanizeSelect(_mm_cmpgt_epi32(zero, v), zero, v);
+			_mm_storeu_si128((__m128i*) (batch.velocity + i), humanizeSelect(noteMask, v, vel));
+		}
+
+		if (settings.timing)
+		{
+			__m128 direction = humanizeDirection(settings.timingPlus, settings.timingMin, batch.draw[H::DrawTimingDirection] + i);
+			__m128 delta = _mm_mul_ps(_mm_mul_ps(direction, _mm_loadu_ps(batch.draw[H::DrawTiming] + i)), ticksPerQuarter);
+			delta = _mm_div_ps(_mm_mul_ps(delta, timingValueF), _mm_set1_ps(800.0f));
+
+			__m128i ts = _mm_loadu_si128((const __m128i*) (batch.timestamp + i));
+			ts = _mm_add_epi32(ts, _mm_cvttps_epi32(delta));
+			ts = humanizeSelect(_mm_cmpgt_epi32(earliest, ts), earliest, ts);
+			ts = humanizeSelect(_mm_cmpgt_epi32(ts, lastTick), lastTick, ts);
+			_mm_storeu_si128((__m128i*) (batch.timestamp + i), ts);
+
+			__m128i over = _mm_and_si128(_mm_cmpgt_epi32(_mm_add_epi32(len, ts), lastTick), noteMask);
+			len = humanizeSelect(over, _mm_sub_epi32(lastTick, ts), len);
+		}
+
+		_mm_storeu_si128((__m128i*) (batch.length + i), len);
+	}
+
+	return n;
+
+} // humanizeSIMD
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzHumanize::apply(const Settings& settings, Batch& batch)
+{
+	if (!settings.any() || (batch.numEvents == 0))
+		return;
+
+#if defined(RIFFZ_HUMANIZE_AVX2) || defined(RIFFZ_HUMANIZE_SSE2)
+	int done = humanizeSIMD(settings, batch);
+#else
+	int done = 0;
+#endif
+
+	applyScalar(settings, batch, done, batch.numEvents);
+
+} // apply
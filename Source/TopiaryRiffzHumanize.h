@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "TopiaryRiffz.h"
+
+/*
+Humanization of generated events in one batch: length, velocity and timing randomization over
+structure-of-arrays copies of the events, SIMD where available (AVX2, SSE2) with a scalar fallback.
+The generator gathers the events to humanize into a Batch (after note randomization and swing), calls
+apply(), and scatters the results back. Results are identical on every path; the scalar version is the
+reference.
+*/
+
+class TopiaryRiffzHumanize
+{
+public:
+	enum Draws	// random draws per event, in this order
+	{
+		DrawNote = 0,
+		DrawLengthDirection,
+		DrawLength,
+		DrawVelocityDirection,
+		DrawVelocity,
+		DrawTimingDirection,
+		DrawTiming,
+		drawsPerEvent
+	};
+
+	struct Settings
+	{
+		bool length = false;		// randomizeLength
+		bool lengthPlus = false;
+		bool lengthMin = false;
+		bool velocity = false;		// randomizeVelocity && (velocityPlus || velocityMin)
+		int velocityValue = 0;
+		bool velocityPlus = false;
+		bool velocityMin = false;
+		bool timing = false;		// randomizeTiming && (timingPlus || timingMin)
+		int timingValue = 0;
+		bool timingPlus = false;
+		bool timingMin = false;
+		int patLenInTicks = 0;
+		int earliestTick = 0;		// timing randomization never moves events before this tick
+
+		bool any() const { return length || velocity || timing; }
+	};
+
+	class Batch
+	{
+	public:
+		void ensureCapacity(int n);
+		void clear() { numEvents = 0; }
+		void add(int slot, int timestamp, int velocity, int length, bool isNote, const float* draws);	// draws: drawsPerEvent values
+
+		int numEvents = 0;
+		HeapBlock<int> slot;			// where the event goes back to; not used by the kernel
+		HeapBlock<int> timestamp;
+		HeapBlock<int> velocity;
+		HeapBlock<int> length;
+		HeapBlock<int> noteMask;		// -1 for notes, 0 for other events (only timing applies to those)
+		HeapBlock<float> draw[drawsPerEvent];	// draw[DrawNote] is not stored
+
+	private:
+		int capacity = 0;
+
+	}; // Batch
+
+	static void apply(const Settings& settings, Batch& batch);
+	static void applyScalar(const Settings& settings, Batch& batch, int from, int to);
+
+}; // TopiaryRiffzHumanize
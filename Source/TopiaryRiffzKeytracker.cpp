@@ -0,0 +1,215 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TopiaryRiffzKeytracker.h"
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline int countTrailingZeros(uint64 x)	// x != 0
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int) index;
+#else
+	return __builtin_ctzll(x);
+#endif
+
+} // countTrailingZeros
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline int countLeadingZeros(uint64 x)	// x != 0
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return 63 - (int) index;
+#else
+	return __builtin_clzll(x);
+#endif
+
+} // countLeadingZeros
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzKeytracker::TopiaryRiffzKeytracker()
+{
+	reset();
+
+} // TopiaryRiffzKeytracker
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzKeytracker::~TopiaryRiffzKeytracker()
+{
+} // ~TopiaryRiffzKeytracker
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzKeytracker::isHeld(int note)
+{
+	return (held[(note >> 6) & 1] >> (note & 63)) & 1;
+
+} // isHeld
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzKeytracker::lowest()
+{
+	if (held[0] != 0)
+		return countTrailingZeros(held[0]);
+	if (held[1] != 0)
+		return 64 + countTrailingZeros(held[1]);
+	return -1;
+
+} // lowest
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzKeytracker::highest()
+{
+	if (held[1] != 0)
+		return 127 - countLeadingZeros(held[1]);
+	if (held[0] != 0)
+		return 63 - countLeadingZeros(held[0]);
+	return -1;
+
+} // highest
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzKeytracker::unlink(int note)
+{
+	if (previous[note] == -1)
+		first = next[note];
+	else
+		next[previous[note]] = next[note];
+
+	if (next[note] == -1)
+		last = previous[note];
+	else
+		previous[next[note]] = previous[note];
+
+} // unlink
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzKeytracker::update()
+{
+	switch (noteOrder)
+	{
+	case TopiaryKeytracker::NoteOrder::Lowest:
+		notePlaying = lowest();
+		break;
+	case TopiaryKeytracker::NoteOrder::Highest:
+		notePlaying = highest();
+		break;
+	case TopiaryKeytracker::NoteOrder::First:
+		notePlaying = first;
+		break;
+	case TopiaryKeytracker::NoteOrder::Last:
+		notePlaying = last;
+		break;
+	default:
+		jassert(false);
+		notePlaying = lowest();
+	}
+
+	if (notePlaying != -1)
+		lastNotePlaying = notePlaying;
+
+} // update
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzKeytracker::push(int note)
+{
+	if ((note < 0) || (note > 127))
+		return;
+
+	if (isHeld(note))
+		unlink(note);	// pressed again without release; it becomes the last one pressed
+	else
+	{
+		held[note >> 6] |= ((uint64) 1) << (note & 63);
+		numHeld++;
+	}
+
+	previous[note] = (int8) last;
+	next[note] = -1;
+	if (last == -1)
+		first = note;
+	else
+		next[last] = (int8) note;
+	last = note;
+
+	update();
+
+} // push
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzKeytracker::pop(int note)
+{
+	if ((note < 0) || (note > 127) || !isHeld(note))
+		return;
+
+	held[note >> 6] &= ~(((uint64) 1) << (note & 63));
+	numHeld--;
+	unlink(note);
+
+	update();
+
+} // pop
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzKeytracker::reset()
+{
+	const int latchedNote = lastNotePlaying;
+
+	held[0] = held[1] = 0;
+	first = last = -1;
+	numHeld = 0;
+	notePlaying = -1;
+	lastNotePlaying = latched ? latchedNote : -1;
+
+} // reset
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzKeytracker::setNoteOrder(int n)
+{
+	noteOrder = n;
+	update(); // another held note may be the one playing now
+
+} // setNoteOrder
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzKeytracker::setLatch(bool l)
+{
+	latched = l;
+
+} // setLatch
@@ -0,0 +1,65 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "TopiaryRiffz.h"
+#include "../Topiary/Source/Model/TopiaryKeytracker.h"
+
+/*
+Keytracker with constant time bookkeeping, for the audio thread.
+Held notes are a 128 bit set (lowest/highest by counting trailing/leading zeros) plus an intrusive list
+in the order the keys went down (first/last). That is the only record of held notes: push, pop and reset
+hide the TopiaryKeytracker ones (which keep a list, so are linear) and never call them. What the shared
+code reads from the base is derived from the set: notePlaying (the held note picked by noteOrder, -1 if
+none) and lastNotePlaying (the last note that was playing; for latch, so reset keeps it when latched).
+Set noteOrder through setNoteOrder, so notePlaying follows.
+*/
+
+class TopiaryRiffzKeytracker : public TopiaryKeytracker
+{
+public:
+	TopiaryRiffzKeytracker();
+	~TopiaryRiffzKeytracker();
+
+	void push(int note);		// key down
+	void pop(int note);			// key up
+	void reset();				// nothing held
+	void setNoteOrder(int n);
+	void setLatch(bool l);
+
+	bool isHeld(int note);
+	int getNumHeld() { return numHeld; }
+
+private:
+	uint64 held[2];				// bit n of held[n >> 6] set if note n is down
+	int8 previous[128];			// intrusive list of held notes, first pressed .. last pressed; -1 ends it
+	int8 next[128];
+	int first = -1;
+	int last = -1;
+	int numHeld = 0;
+	bool latched = false;
+
+	int lowest();
+	int highest();
+	void unlink(int note);
+	void update();
+
+	JUCE_DECLARE_NON_COPYABLE(TopiaryRiffzKeytracker)
+
+}; // TopiaryRiffzKeytracker
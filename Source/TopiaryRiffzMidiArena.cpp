@@ -0,0 +1,66 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TopiaryRiffzMidiArena.h"
+
+TopiaryRiffzMidiArena::TopiaryRiffzMidiArena()
+{
+} // TopiaryRiffzMidiArena
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzMidiArena::~TopiaryRiffzMidiArena()
+{
+} // ~TopiaryRiffzMidiArena
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzMidiArena::prepare(MidiBuffer& buffer, int maxEvents)
+{
+	// all buffers prepared with the same arena get the same room; the largest request wins
+
+	int bytes = maxEvents * bytesPerEvent;
+	if (bytes > capacityInBytes)
+	{
+		capacityInBytes = bytes;
+		noteOnLimitInBytes = (capacityInBytes * 3) / 4;
+	}
+
+	buffer.ensureSize((size_t) capacityInBytes);
+
+} // prepare
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzMidiArena::add(MidiBuffer& buffer, const MidiMessage& msg, int samplePosition)
+{
+	const int needed = (int) (sizeof(int32) + sizeof(uint16)) + msg.getRawDataSize();
+	const int used = buffer.data.size();
+	const int limit = msg.isNoteOff() ? capacityInBytes : noteOnLimitInBytes;
+
+	if ((used + needed) > limit)
+	{
+		++numOverflows;	// audio thread and audition notes
+		return false;
+	}
+
+	buffer.addEvent(msg, samplePosition);
+	return true;
+
+} // add
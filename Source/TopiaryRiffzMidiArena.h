@@ -0,0 +1,52 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "TopiaryRiffz.h"
+
+/*
+Capacity check for MidiBuffers written on the audio thread. prepare() reserves room for maxEvents
+(off the audio thread); add() refuses anything that would make the buffer grow, so the audio thread
+never calls the allocator. Writers of one buffer are serialized by the caller (lockModel).
+Overflow policy: the last quarter of the room is kept for note offs, so a burst of new notes can not
+leave notes hanging; what is refused is counted (getNumOverflows).
+*/
+
+class TopiaryRiffzMidiArena
+{
+public:
+	TopiaryRiffzMidiArena();
+	~TopiaryRiffzMidiArena();
+
+	static const int bytesPerEvent = (int) (sizeof(int32) + sizeof(uint16)) + 3;	// how MidiBuffer stores a 3 byte message
+
+	void prepare(MidiBuffer& buffer, int maxEvents);						// not on the audio thread
+	bool add(MidiBuffer& buffer, const MidiMessage& msg, int samplePosition);	// false if refused
+
+	int getNumOverflows() { return numOverflows.get(); }
+	void resetNumOverflows() { numOverflows.set(0); }
+
+private:
+	int capacityInBytes = 0;
+	int noteOnLimitInBytes = 0;			// above this, only note offs (and note on with velocity 0) go in
+	Atomic<int> numOverflows { 0 };
+
+	JUCE_DECLARE_NON_COPYABLE(TopiaryRiffzMidiArena)
+
+}; // TopiaryRiffzMidiArena
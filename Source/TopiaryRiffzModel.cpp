@@ -85,8 +85,7 @@ TopiaryRiffzModel::TopiaryRiffzModel()
 
 	patternList.setModel(this);
 
-	for (int p = 0; p < 8; p++)
-		patternData[p].setModel(this);
+	patternData.setModel(this);
 
 	/////////////////////////////////////
 	// variations initialisation
@@ -98,8 +97,6 @@ TopiaryRiffzModel::TopiaryRiffzModel()
 		//variation[i].patternToUse = -1;				// index in patterndata
 		variation[i].noteAssignmentList.setRiffzModel(this);
 		variation[i].lenInMeasures = 0;
-		for (int j=0; j < MAXPATTERNSINVARIATION; j++)
-			variation[i].pattern[j].patLenInTicks = 0;
 		variation[i].type = Topiary::VariationTypeSteady;								// indicates that once pattern played, we no longer generate notes! (but we keep running (status Ended) till done
 		variation[i].ended = false;
 
@@ -123,6 +120,13 @@ TopiaryRiffzModel::TopiaryRiffzModel()
 		variation[i].lengthValue = 0;
 		
 		variation[i].swingQ = TopiaryRiffzModel::SwingQButtonIds::SwingQ4;
+		variation[i].numTakes = 0; // takes cost a generated pattern each; off unless asked for
+		variation[i].randomSeed = Random::getSystemRandom().nextInt();
+		for (int j = 0; j < MAXPATTERNSINVARIATION; j++)
+		{
+			variation[i].renderIteration[j] = 0;
+			variation[i].plainSource[j].set(-1);
+		}
 		
 	}
 
@@ -130,12 +134,7 @@ TopiaryRiffzModel::TopiaryRiffzModel()
 	// PatternData initialization
 	/////////////////////////////////////
 
-
-	for (int i = 0; i < MAXNOPATTERNS; ++i)
-	{
-		
-		patternData[i].numItems = 0;
-	}
+	// nothing to do: patternData allocates (empty) patterns when first used
 	/////////////////////////////////////
 	// VariationSwitch initialization
 	/////////////////////////////////////
@@ -152,7 +151,11 @@ TopiaryRiffzModel::TopiaryRiffzModel()
 	midiChannelListening = 0;
 
 	overrideHostTransport = true;
-	keytracker.noteOrder = TopiaryKeytracker::NoteOrder::Lowest;
+	keytracker.setNoteOrder(TopiaryKeytracker::NoteOrder::Lowest);
+	keytracker.setLatch(latch1 || latch2);
+
+	prepareMidiBuffers(nullptr); // room in modelEventBuffer; the output buffer belongs to the (shared) processor
+	takeRenderer.startTimer(50);
 
 } // TopiaryRiffzModel
 
@@ -160,6 +163,7 @@ TopiaryRiffzModel::TopiaryRiffzModel()
 
 TopiaryRiffzModel::~TopiaryRiffzModel()
 {
+	takeRenderer.stopTimer();
 
 } //~TopiaryRiffzModel
 
@@ -241,41 +245,41 @@ void TopiaryRiffzModel::deletePattern(int deletePattern)
 	jassert(deletePattern < patternList.getNumItems()); // number has to be smaller than number of children (it starts at 0)
 	
 	patternList.del(deletePattern);
-	patternData[deletePattern].numItems = 0; // make sure it's classified as empty
 
-	// now shift down any other patterns in patternData
-	for (int p = deletePattern; p < (patternList.numItems); p++)
-	{
-		TopiaryPattern dummy;
-		dummy = patternData[p];
-		patternData[p] = patternData[p + 1];
-		patternData[p + 1] = dummy;
-	}
-
-	Log("Pattern "+String(deletePattern)+" deleted.", Topiary::LogType::Info);
-	
-	// if there are variations that use this pattern, those note assignments need to be removed
-	// any other noteAssignments need to be renumbered in terms of Id
-	// loop over all variations
-	bool deassigned = false;
+	// note assignments keep their patterns: the ones of the deleted pattern go, the ones behind it move up one index
+	bool changed[8];
 	for (int v = 0; v < 8; v++)
 	{
-		// loop over all note assignments
+		changed[v] = false;
 		for (int na = 0; na < variation[v].noteAssignmentList.numItems; na++)
 		{
-			// if the assignment uses this pattern; delete it
-			variation[v].noteAssignmentList.del(na);
-			deassigned = true;
-			/*
 			if (variation[v].noteAssignmentList.dataList[na].patternId == deletePattern)
+			{
 				variation[v].noteAssignmentList.del(na);
-			else // if the pattern's Id is higher than the deleted one, decrease by one
-				if (variation[v].noteAssignmentList.dataList[na].patternId > deletePattern)
-					variation[v].noteAssignmentList.dataList[na].patternId--;
-			*/
-		} // loop over all note assignments
-		redoPatternLookup(v);
-	} //loop over all variations
+				na--;
+				changed[v] = true;
+			}
+			else if (variation[v].noteAssignmentList.dataList[na].patternId > deletePattern)
+			{
+				variation[v].noteAssignmentList.dataList[na].patternId--;
+				changed[v] = true;
+			}
+		}
+
+		if (changed[v])
+			redoPatternLookup(v);
+	}
+
+	// the patterns behind it move up too; only their handles move
+	patternData.remove(deletePattern);
+	invalidateMBT(-1);
+
+	Log("Pattern "+String(deletePattern)+" deleted.", Topiary::LogType::Info);
+
+	for (int v = 0; v < 8; v++)
+		if (changed[v])
+			markVariationDirty(v); // pattern indexes in the renders changed
+	regenerateDirty();
 			
 	broadcaster.sendActionMessage(MsgPatternList);
 	broadcaster.sendActionMessage(MsgVariationDefinition);  // something may have changed to the currently shown variation (it might be disabled)
@@ -406,6 +410,7 @@ void TopiaryRiffzModel::setLatch(bool l1, bool l2)
 {
 	latch1 = l1;
 	latch2 = l2;
+	keytracker.setLatch(latch1 || latch2);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -432,7 +437,7 @@ int TopiaryRiffzModel::getOutputChannel()
 
 void TopiaryRiffzModel::setNoteOrder(int n)
 {
-	keytracker.noteOrder = n;
+	keytracker.setNoteOrder(n);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -510,9 +515,14 @@ void TopiaryRiffzModel::setVariationDefinition(int i, bool enabled, String vname
 
 	//int lenInMeasures = getPatternLengthInMeasures(patternId);
 
+	bool wasEnabled = variation[i].enabled;
 	variation[i].name = vname;
 	variation[i].enabled = enabled;
 	variation[i].type = type;
+
+	if (enabled && !wasEnabled)
+		generateVariation(i, -1); // regenerations are not done while disabled
+
 	if (!enabled)
 	{
 		// make sure to enable hostOverride if there are no enabled variations
@@ -623,9 +633,10 @@ void TopiaryRiffzModel::setSwing(int v, bool enable, int value)
 	prevBoolSwing = enable;
 	*boolSwing = enable;
 	variation[v].swingValue = value;
+	rebuildSwingTable(v);
 	generateVariation(v, -1);
 
-} // getSwing
+} // setSwing
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -694,6 +705,7 @@ void TopiaryRiffzModel::getRandomizeTiming(int v, bool &enable, int &value, bool
 void TopiaryRiffzModel::setSwingQ(int v, int q)
 {
 	variation[v].swingQ = q;
+	rebuildSwingTable(v);
 	generateVariation(v, -1);
 }
 
@@ -742,11 +754,11 @@ void TopiaryRiffzModel::saveNoteAssignment(int v, int n, int o, int p)
 	// make sure that all patterns in this variation have same length
 	
 	
-	int newPatLen = patternData[p].patLenInTicks;
+	int newPatLen = patternData.read(p).patLenInTicks;
 
 	for (int i = 0; i < variation[v].noteAssignmentList.getNumItems(); i++)
 	{
-		if (patternData[variation[v].noteAssignmentList.dataList[i].patternId ].patLenInTicks != newPatLen)
+		if (patternData.read(variation[v].noteAssignmentList.dataList[i].patternId).patLenInTicks != newPatLen)
 		{
 			Log("All patterns in a varation must have same length.", Topiary::Warning);
 			return;
@@ -802,6 +814,7 @@ void TopiaryRiffzModel::getNoteAssignment(int v, int i, String& n, int& o, int&
 void TopiaryRiffzModel::deleteNoteAssignment(int v, int i)
 {
 	variation[v].noteAssignmentList.del(i);
+	redoPatternLookup(v);
 	generateVariation(v, -1);
 }
 
@@ -810,6 +823,29 @@ void TopiaryRiffzModel::deleteNoteAssignment(int v, int i)
 void TopiaryRiffzModel::generateVariation(int v, int eightToGenerate)
 {
 	// calls generateVaration(v, p, measureToGenerate) for each pattern
+	// full regenerations go through the scheduler, so they coalesce with whatever else is dirty
+
+	if (eightToGenerate == -1)
+	{
+		markVariationDirty(v);
+		regenerateDirty();
+		return;
+	}
+
+	// generateMidi regenerates the running variation every eighth; that is where the audio thread picks up
+	// what was regenerated off the audio thread meanwhile, and at the first eighth of a loop the next take.
+	// The cursor is generateMidi's and can not be re-walked from here, so swapLivePatterns only replaces
+	// parentPattern where the cursor's event index stays valid; the return value needs no action
+	if (v == variationRunning)
+	{
+		if ((eightToGenerate == 0) && usesTakes(v))
+			consumeNextTakes();
+		else
+			acquireGeneratedPatterns(eightToGenerate == 0);
+	}
+
+	if (usesTakes(v))
+		return; // takes are humanized as a whole when rendered; nothing to redo per eighth
 	
 	for (int p = 0; p < MAXPATTERNSINVARIATION; p++)
 		if (variation[v].patternLookUp[p].patternInVariationId != -1)
@@ -819,58 +855,82 @@ void TopiaryRiffzModel::generateVariation(int v, int eightToGenerate)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void TopiaryRiffzModel::generateVariation(int v, int p, int eightToGenerate)
+void TopiaryRiffzModel::generateVariation(int v, int p, int eightToGenerate, bool asTake)
 {
 	// (re)generates variation[v].pattern[p]
 
 	jassert((v < 8) && (v >= 0));
 	int tickFrom = -1;
-	int tickTo = -1;
 
 	if (!variation[v].enabled)
 		return;
 
+	TopiaryRiffzGeneratedPattern* var;
+
+	jassert(!asTake || (eightToGenerate == -1));
+
+	// find out which pattern to use in the variation; we are talking source patterns in the pattern structure, not in the variation itself
+	int patternToUse = 	findPatternInVariation(v, p);  
+
+	// without humanization or swing every variation renders a source pattern the same way;
+	// those share one render per source pattern (plainRender) instead of each copying it
+	const bool plain = isPlain(v);
+	jassert(!asTake || !plain);
+
+	if (plain && (eightToGenerate == -1) && flushingDirty && (plainRenderedInFlush & ((uint32) 1 << patternToUse)))
+	{
+		variation[v].plainSource[p].set(patternToUse); // rendered for another variation in this same regeneration
+		return;
+	}
+
 	if (eightToGenerate == -1)
 	{
 		// meaning we regererate the lot
-		// reset numItems
-		variation[v].pattern[p].numItems = 0;
+		// this happens off the audio thread, in the back buffer; published at the end
+		var = plain ? plainRender[patternToUse].getBack() : variation[v].pattern[p].getBack();
+		if (var == nullptr)
+			return; // every buffer is still queued or in use
+		var->numItems = 0;
 	}
 	else
 	{
-		// set tickFrom and tickTo based on eightToGenerate
-		tickFrom = eightToGenerate * Topiary::TicksPerQuarter / 2;
-		tickTo = tickFrom + Topiary::TicksPerQuarter / 2;
-	}
+		// regenerating an eighth happens on the audio thread, in the pattern being played
+		if (variation[v].plainSource[p].get() != -1)
+			return; // shared plain render; nothing random to redo
 
+		var = variation[v].pattern[p].getLive();
+		if (var == nullptr)
+			return; // nothing generated yet
 
-	// set every event in the variation to miditype::NOP
+		// set tickFrom based on eightToGenerate
+		tickFrom = eightToGenerate * Topiary::TicksPerQuarter / 2;
+	}
 
-	TopiaryVariation* var = &(variation[v].pattern[p]); 
 
-	// find out which pattern to use in the variation; we are talking source patterns in the pattern structure, not in the variation itself
-	int patternToUse = 	findPatternInVariation(v, p);  
+	// source events to (re)generate: all of them, or only the ones in the eighth's bucket
+	// every event we visit gets its midiType set below, so there is no need to NOP anything first
+	const int* eighthEvents = nullptr;
+	int numToGenerate;
 
-	TopiaryPattern* pat = &(patternData[patternToUse]);
 	if (eightToGenerate == -1)
 	{
 		// make sure it's initialized properly - only done from editor or @ load
+		const TopiaryPattern* pat = &(patternData.read(patternToUse)); // message thread; the eighth path reads the snapshot indexSourcePattern takes
 		var->numItems = pat->numItems;
 		for (int j = 0; j < pat->numItems; j++)
 		{
 			var->dataList[j].ID = j + 1;
 			var->dataList[j].timestamp = pat->dataList[j].timestamp;
-			//int measre = pat->dataList[v].timestamp % (numerator * Topiary::TicksPerQuarter);
 			var->dataList[j].midiType = Topiary::MidiType::NOP;
 		}
-
-	}
-	else for (int j = 0; j < pat->numItems; j++)
-	{
-		//int measre = (int) pat->dataList[j].timestamp / (numerator * Topiary::TicksPerQuarter);
-		if ( ((var->dataList[j].timestamp >=tickFrom) && (var->dataList[j].timestamp < tickTo))  )
-			var->dataList[j].midiType = Topiary::MidiType::NOP;
+		var->resetSlots();
+		var->indexSourcePattern(pat);
+		numToGenerate = pat->numItems;
 	}
+	else
+		numToGenerate = var->getEighth(eightToGenerate, eighthEvents);
+
+	const TopiaryRiffzGeneratedPattern::SourceEvent* source = var->getSourceEvents();
 
 	////////////////////////////
 	// GENERATE NOTES & EVENTS
@@ -878,259 +938,261 @@ void TopiaryRiffzModel::generateVariation(int v, int p, int eightToGenerate)
 	
 	Logger::outputDebugString("Generating notes & events variation " + String(v) + " pattern " + String(p) + ".");
 
-	Random randomizer;
+	// random draws: drawsPerEvent per source event, numbered by source index, so any event gets the same draws
+	// whether the whole pattern or only its eighth is generated
+	// stream: render (every take is a new one) in the high word, loops played since that render and the slot in the low one,
+	// so a loop of one render can never draw what another render draws
+	if (eightToGenerate == -1)
+	{
+		if (asTake)
+			variation[v].renderIteration[p] = (variation[v].renderIteration[p] + 1) & 0x7FFFFFFF;
+
+		var->renderIteration = variation[v].renderIteration[p];
+		var->loopIteration = 0;
+	}
+	else if (eightToGenerate == 0)
+		var->loopIteration = (var->loopIteration + 1) & 0x00FFFFFF; // new loop; new humanization
+
+	TopiaryRiffzRandom randomizer(variation[v].randomSeed, ((int64) var->renderIteration << 32) | ((int64) var->loopIteration << 8) | p);
+	const int drawsPerEvent = TopiaryRiffzHumanize::drawsPerEvent;
+	float eventDraws[drawsPerEvent];
+	float* draws;
+
+	if ((eightToGenerate == -1) && !plain)
+	{
+		// whole pattern in one batch; message thread only so the scratch buffer is ours
+		if (generatorDrawsCapacity < (numToGenerate * drawsPerEvent))
+		{
+			generatorDrawsCapacity = numToGenerate * drawsPerEvent;
+			generatorDraws.realloc(generatorDrawsCapacity);
+		}
+		randomizer.fillFloats(generatorDraws, numToGenerate * drawsPerEvent, 0);
+	}
 	
-	var->patLenInTicks = pat->patLenInTicks; // make sure length is correct
+	var->patLenInTicks = var->getSourceLength(); // make sure length is correct
+
+	TopiaryRiffzHumanize::Settings humanizeSettings;
+	humanizeSettings.length = variation[v].randomizeLength;
+	humanizeSettings.lengthPlus = variation[v].lengthPlus;
+	humanizeSettings.lengthMin = variation[v].lengthMin;
+	humanizeSettings.velocity = variation[v].randomizeVelocity && (variation[v].velocityPlus || variation[v].velocityMin);
+	humanizeSettings.velocityValue = variation[v].velocityValue;
+	humanizeSettings.velocityPlus = variation[v].velocityPlus;
+	humanizeSettings.velocityMin = variation[v].velocityMin;
+	humanizeSettings.timing = variation[v].randomizeTiming && (variation[v].timingPlus || variation[v].timingMin);
+	humanizeSettings.timingValue = variation[v].timingValue;
+	humanizeSettings.timingPlus = variation[v].timingPlus;
+	humanizeSettings.timingMin = variation[v].timingMin;
+	humanizeSettings.patLenInTicks = var->patLenInTicks;
+	humanizeSettings.earliestTick = (eightToGenerate == -1) ? 0 : tickFrom; // make sure we do not loose a note due to too early
+
+	// swing table is only rebuilt off the audio thread; settings changes always trigger a full regeneration first
+	if (eightToGenerate == -1)
+		rebuildSwingTable(v);
+	jassert((variation[v].swingTableValue == variation[v].swingValue) && (variation[v].swingTableQ == variation[v].swingQ));
+
+	const int swingSpan = (variation[v].swingQ == Topiary::SwingQButtonIds::SwingQ8) ? (Topiary::TicksPerQuarter / 2) : Topiary::TicksPerQuarter;
+	int swingBase = (eightToGenerate == -1) ? 0 : (tickFrom / swingSpan) * swingSpan;
+
+	// the batch lives in the generated pattern, so whoever owns that (writer or audio thread) owns the scratch
+	TopiaryRiffzHumanize::Batch& batch = var->humanizeBatch;
+	batch.clear();
 
 	int note;
 	int vIndex; 
 
 	
-	for (int pIndex = 0; pIndex < pat->numItems; pIndex++)
+	for (int e = 0; e < numToGenerate; e++)
 	{
-		//if (((*pat).dataList[pIndex].measure == measureToGenerate) || (measureToGenerate == -1))
-		if ( (((*pat).dataList[pIndex].timestamp >= tickFrom) && ((*pat).dataList[pIndex].timestamp < tickTo)) || (eightToGenerate == -1)  )
+		int pIndex = (eighthEvents == nullptr) ? e : eighthEvents[e];
+		bool doNote = true;
+
+		if (plain)
+			draws = nullptr; // never read: no note randomization, nothing to humanize
+		else if (eighthEvents == nullptr)
+			draws = generatorDraws + pIndex * drawsPerEvent;
+		else
 		{
-			bool doNote = true;
-			vIndex = var->findID(pIndex + 1);
-
-			note = (*pat).dataList[pIndex].note;
-			int midiType = (*pat).dataList[pIndex].midiType;
-
-			if (midiType == Topiary::NoteOn)
-			{
-				var->dataList[vIndex].note = note;
-				// note randomization logic
-				
-				vIndex = var->findID(pIndex + 1);
+			randomizer.fillFloats(eventDraws, drawsPerEvent, (int64) pIndex * drawsPerEvent);
+			draws = eventDraws;
+		}
 
-				if (variation[v].randomizeNotes)
-				{
-					float rnd = randomizer.nextFloat();
-					// decide whether we're generating this one or not
-					if (rnd > ((float)variation[v].randomizeNotesValue / 100))
-					{
-						doNote = false;
-					}
+		vIndex = var->findSlot(pIndex + 1);
 
-				};
+		note = source[pIndex].note;
+		int midiType = source[pIndex].midiType;
 
-				// if (doNote) we will generate a note on event; if not it will be a NOP event
-				if (doNote)
-					var->dataList[vIndex].midiType = Topiary::MidiType::NoteOn;
-				else
-					var->dataList[vIndex].midiType = Topiary::MidiType::NOP;
+		// always start from the source timestamp, so timing randomization does not add up over regenerated eighths
+		var->dataList[vIndex].timestamp = source[pIndex].timestamp;
 
-				// length randomisation
-				var->dataList[vIndex].length = pat->dataList[pIndex].length;
+		if (midiType == Topiary::NoteOn)
+		{
+			var->dataList[vIndex].note = note;
+			// note randomization logic
 
-				if (variation[v].randomizeLength)
+			if (variation[v].randomizeNotes)
+			{
+				float rnd = draws[TopiaryRiffzHumanize::DrawNote];
+				// decide whether we're generating this one or not
+				if (rnd > ((float)variation[v].randomizeNotesValue / 100))
 				{
-					int len = pat->dataList[vIndex].length;
-					float rnd;
-					int direction;
-					if (variation[v].lengthPlus && variation[v].lengthMin)
-					{
-						rnd = randomizer.nextFloat();
-						if (rnd > 0.5)
-							direction = 1;
-						else
-							direction = -1;
-					}
-					else if (variation[v].velocityPlus)
-						direction = 1;
-					else direction = -1;
+					doNote = false;
+				}
 
-					rnd = randomizer.nextFloat();
-					//int debug = direction * rnd * 128 * variation[v].velocityValue /100;
-					len = len + (int)(direction * rnd * 128 * len / 100);   // originally / 100 but I want more of an effect
+			};
 
-					/// make sure it does not run over length of the pattern
-					/// int length = var->dataList[vIndex].length;
-					if (len >= var->patLenInTicks)
-					{
-						len = var->patLenInTicks - 1;
-					}
-					else if (len < 0)
-						len = 1;
-
-					var->dataList[vIndex].length = len;
-						
-				} // end randomize length
-
-				var->dataList[vIndex].velocity = pat->dataList[pIndex].velocity;
-				int timestamp = pat->dataList[pIndex].timestamp;
-				var->dataList[vIndex].timestamp = timestamp;
-				if (doNote)
-					if (variation[v].randomizeVelocity && (variation[v].velocityPlus || variation[v].velocityMin))
-					{
-						int vel = pat->dataList[pIndex].velocity;
-						float rnd;
-						int direction;
-						if (variation[v].velocityPlus && variation[v].velocityMin)
-						{
-							rnd = randomizer.nextFloat();
-							if (rnd > 0.5)
-								direction = 1;
-							else
-								direction = -1;
-						}
-						else if (variation[v].velocityPlus)
-							direction = 1;
-						else direction = -1;
-
-						rnd = randomizer.nextFloat();
-					
-						vel = vel + (int)(direction * rnd * 128 * variation[v].velocityValue / 50);   // originally / 100 but I want more of an effect
-
-						if (variation[v].randomizeVelocity)
-						vel = vel + variation[v].velocityValue;
-
-						if (vel > 127) vel = 127;
-						else if (vel < 0) 
-							vel = 0;
-						
-						var->dataList[vIndex].velocity = vel;
-
-					} // velocity randomization
-
-				if (variation[v].swing && doNote)
-				{
-					// recalc the timestamp, based on the swing lookup table
-					//Logger::outputDebugString("Timestamp pre " + String(timestamp));
-					int base;
-
-					//double debugFirst;
-					//int debugSecond;
-					//int debugThird;
-					if (variation[v].swingQ == Topiary::SwingQButtonIds::SwingQ8)
-					{
-						base = ((int)floor(timestamp / (Topiary::TicksPerQuarter / 2))) * (int)(Topiary::TicksPerQuarter / 2);
-						//debugFirst = floor(timestamp / (Topiary::TicksPerQuarter / 2));
-						//debugSecond = (int)(Topiary::TicksPerQuarter / 2);
-						//debugThird = (int)floor(timestamp / (Topiary::TicksPerQuarter / 2));
-					}
-					else
-						base = ((int)floor(timestamp / Topiary::TicksPerQuarter)) * Topiary::TicksPerQuarter;
+			// if (doNote) we will generate a note on event; if not it will be a NOP event
+			if (doNote)
+				var->dataList[vIndex].midiType = Topiary::MidiType::NoteOn;
+			else
+				var->dataList[vIndex].midiType = Topiary::MidiType::NOP;
 
-					//Logger::outputDebugString("Remainder pre " + String(timestamp-base));
+			var->dataList[vIndex].length = source[pIndex].length;
+			var->dataList[vIndex].velocity = source[pIndex].velocity;
+			int timestamp = source[pIndex].timestamp;
 
-					int remainder = swing(timestamp - base, variation[v].swingValue, variation[v].swingQ);
-					var->dataList[vIndex].timestamp = base + remainder;
-						
-					//Logger::outputDebugString("Remainder post" + String (remainder));
-					//Logger::outputDebugString("New Timestamp " + String(base + remainder) + " (DIFF: " + String (timestamp-base-remainder));
+			if (variation[v].swing && doNote)
+			{
+				// source events come in timestamp order, so the swing base only moves forward; the new remainder comes from the table
+				while (timestamp >= (swingBase + swingSpan))
+					swingBase += swingSpan;
+				if (timestamp < swingBase)
+					swingBase = (timestamp / swingSpan) * swingSpan; // out of order after all; start over from here
 
-					jassert((remainder) <= Topiary::TicksPerQuarter);
-				jassert((base + remainder) >= 0);
+				var->dataList[vIndex].timestamp = swingBase + variation[v].swingTable[timestamp - swingBase];
 
-				} // swing
-			} // end of note specific randomization stuff, except for timing
-			else if (midiType == Topiary::CC)
-			{
-				var->dataList[vIndex].midiType = Topiary::CC;
-				var->dataList[vIndex].CC = pat->dataList[pIndex].length;
-				var->dataList[vIndex].value = pat->dataList[pIndex].value;
-			}
-			else if (midiType == Topiary::AfterTouch)
-			{ 
-				var->dataList[vIndex].midiType = Topiary::AfterTouch;
-				var->dataList[vIndex].value = pat->dataList[pIndex].value;
-			}
-			else if (midiType == Topiary::Pitch)
-			{
-				var->dataList[vIndex].midiType = Topiary::Pitch;
-				var->dataList[vIndex].value = pat->dataList[pIndex].value;
-			}
-			else 
-				jassert(false);
-					
-			// we apply timing randomization AFTER possible swing !!!
-			if ((doNote) || (midiType != Topiary::NoteOn))
-					if (variation[v].randomizeTiming && (variation[v].timingPlus || variation[v].timingMin))
-					{
-						int timestamp = var->dataList[vIndex].timestamp;
-						float rnd;
-						int direction = -1;
-						if (variation[v].velocityPlus && variation[v].velocityMin)
-						{
-							rnd = randomizer.nextFloat();
-							if (rnd > 0.5)
-								direction = 1;
-						}
-						else if (variation[v].velocityPlus)
-							direction = 1;
-
-						rnd = randomizer.nextFloat();
-						//int debug = direction * rnd * Topiary::TicksPerQuarter * variation[v].timingValue /100;
-						timestamp = timestamp + (int)(direction * rnd * Topiary::TicksPerQuarter * variation[v].timingValue / 800);
-						if (timestamp < 0) timestamp = 0;
-						if (eightToGenerate != -1) // make sure we do not loose a note due to too early
-							if (timestamp < tickFrom)
-								timestamp = tickFrom;
-
-						if (timestamp > (var->patLenInTicks - 1)) timestamp = var->patLenInTicks - 1; // lenInTicks -1 because we need time for the note off event
-						var->dataList[vIndex].timestamp = timestamp;
-
-						if (midiType == Topiary::NoteOn)
-						{
-							// make sure we do not run over the patternlenght with note off
-							// and only for notes
-							int length = var->dataList[vIndex].length;
-							if ((length + timestamp) >= var->patLenInTicks)
-							{
-								length = var->patLenInTicks - timestamp - 1;
-								var->dataList[vIndex].length = length;
-								jassert(length > 0);
-							}
-						}
-						
-					} // end randomize timing
-
-		//Logger::outputDebugString("Generating Note " + String(var->dataList[vIndex].note) + " timestamp " + String(var->dataList[vIndex].timestamp));
-		//auto debug = 0;
-		
-		} // end check for measureToGenerate
+			} // swing
+		} // end of note specific randomization stuff, except for timing
+		else if (midiType == Topiary::CC)
+		{
+			var->dataList[vIndex].midiType = Topiary::CC;
+			var->dataList[vIndex].CC = source[pIndex].length;
+			var->dataList[vIndex].value = source[pIndex].value;
+		}
+		else if (midiType == Topiary::AfterTouch)
+		{ 
+			var->dataList[vIndex].midiType = Topiary::AfterTouch;
+			var->dataList[vIndex].value = source[pIndex].value;
+		}
+		else if (midiType == Topiary::Pitch)
+		{
+			var->dataList[vIndex].midiType = Topiary::Pitch;
+			var->dataList[vIndex].value = source[pIndex].value;
+		}
+		else 
+			jassert(false);
+				
+		// length, velocity and timing randomization are done in one batch below; timing goes AFTER possible swing !!!
+		if (humanizeSettings.any() && ((doNote) || (midiType != Topiary::NoteOn)))
+			batch.add(vIndex, var->dataList[vIndex].timestamp, var->dataList[vIndex].velocity, var->dataList[vIndex].length,
+				(midiType == Topiary::NoteOn), draws);
+
+	//Logger::outputDebugString("Generating Note " + String(var->dataList[vIndex].note) + " timestamp " + String(var->dataList[vIndex].timestamp));
+	//auto debug = 0;
+	
 	}  // for children in original pattern
 
+	TopiaryRiffzHumanize::apply(humanizeSettings, batch);
+	for (int b = 0; b < batch.numEvents; b++)
+	{
+		vIndex = batch.slot[b];
+		var->dataList[vIndex].timestamp = batch.timestamp[b];
+		var->dataList[vIndex].velocity = batch.velocity[b];
+		var->dataList[vIndex].length = batch.length[b];
+		jassert((var->dataList[vIndex].midiType != Topiary::NoteOn) || (var->dataList[vIndex].length > 0));
+	}
+
 	////////// end note generation
 	
-	
-	
 
 	//Logger::outputDebugString("SORTED ------------------------");
-	variation[v].pattern[p].sortByTimestamp();
+	var->sortByTimestamp();
+
+	if (eightToGenerate == -1)
+	{
+		if (plain)
+		{
+			plainRender[patternToUse].publish();
+			variation[v].plainSource[p].set(patternToUse); // after the publish, so the audio thread finds the render there
+			if (flushingDirty)
+				plainRenderedInFlush |= (uint32) 1 << patternToUse;
+		}
+		else
+		{
+			if (asTake)
+				variation[v].pattern[p].publishTake();
+			else
+				variation[v].pattern[p].publish();
+
+			variation[v].plainSource[p].set(-1); // copy on write: humanization or swing switched on, the slot plays its own render from now on
+		}
+	}
 	
+#ifdef _DEBUG
+	if ((eightToGenerate != -1) || asTake)
+		return; // dumping the whole pattern for every eighth or take would cost more than generating it
+
 	Logger::outputDebugString("------------------------");
-	for (int j = 0; j < variation[v].pattern[p].numItems; j++)
+	for (int j = 0; j < var->numItems; j++)
 	{
-		if (variation[v].pattern[p].dataList[j].midiType == Topiary::NoteOn)
-				Logger::outputDebugString("<" + String(j) + "> <ID" + String(variation[v].pattern[p].dataList[j].ID)+"> Note: " + String(variation[v].pattern[p].dataList[j].note) + 
-					" timestamp " + String(variation[v].pattern[p].dataList[j].timestamp) + 
-					" len " + String(variation[v].pattern[p].dataList[j].length) +
-					" velo " + String(variation[v].pattern[p].dataList[j].velocity) +
-					" midiType " + String(variation[v].pattern[p].dataList[j].midiType));
-		else if (variation[v].pattern[p].dataList[j].midiType == Topiary::CC)
-			Logger::outputDebugString("<" + String(j) + "> <ID" + String(variation[v].pattern[p].dataList[j].ID) + "> CC: " + String(variation[v].pattern[p].dataList[j].CC) +
-				" timestamp " + String(variation[v].pattern[p].dataList[j].timestamp) +
-				" value " + String(variation[v].pattern[p].dataList[j].value) );
-		else if (variation[v].pattern[p].dataList[j].midiType == Topiary::AfterTouch)
-			Logger::outputDebugString("<" + String(j) + "> <ID" + String(variation[v].pattern[p].dataList[j].ID) + "> AT " + 
-				" timestamp " + String(variation[v].pattern[p].dataList[j].timestamp) +
-				" value " + String(variation[v].pattern[p].dataList[j].value));
-		else if (variation[v].pattern[p].dataList[j].midiType == Topiary::Pitch)
-			Logger::outputDebugString("<" + String(j) + "> <ID" + String(variation[v].pattern[p].dataList[j].ID) + "> Pitch: " + 
-				" timestamp " + String(variation[v].pattern[p].dataList[j].timestamp) +
-				" value " + String(variation[v].pattern[p].dataList[j].value));
+		if (var->dataList[j].midiType == Topiary::NoteOn)
+				Logger::outputDebugString("<" + String(j) + "> <ID" + String(var->dataList[j].ID)+"> Note: " + String(var->dataList[j].note) + 
+					" timestamp " + String(var->dataList[j].timestamp) + 
+					" len " + String(var->dataList[j].length) +
+					" velo " + String(var->dataList[j].velocity) +
+					" midiType " + String(var->dataList[j].midiType));
+		else if (var->dataList[j].midiType == Topiary::CC)
+			Logger::outputDebugString("<" + String(j) + "> <ID" + String(var->dataList[j].ID) + "> CC: " + String(var->dataList[j].CC) +
+				" timestamp " + String(var->dataList[j].timestamp) +
+				" value " + String(var->dataList[j].value) );
+		else if (var->dataList[j].midiType == Topiary::AfterTouch)
+			Logger::outputDebugString("<" + String(j) + "> <ID" + String(var->dataList[j].ID) + "> AT " + 
+				" timestamp " + String(var->dataList[j].timestamp) +
+				" value " + String(var->dataList[j].value));
+		else if (var->dataList[j].midiType == Topiary::Pitch)
+			Logger::outputDebugString("<" + String(j) + "> <ID" + String(var->dataList[j].ID) + "> Pitch: " + 
+				" timestamp " + String(var->dataList[j].timestamp) +
+				" value " + String(var->dataList[j].value));
 	}
 	Logger::outputDebugString("------------------------");
+#endif
 	
 } // generateVariation
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+void TopiaryRiffzModel::rebuildSwingTable(int v)
+{
+	// swing remainders for the current swingValue and swingQ; only recalculated when one of them changed
+
+	if ((variation[v].swingTableValue == variation[v].swingValue) && (variation[v].swingTableQ == variation[v].swingQ))
+		return;
+
+	const int swingSpan = (variation[v].swingQ == Topiary::SwingQButtonIds::SwingQ8) ? (Topiary::TicksPerQuarter / 2) : Topiary::TicksPerQuarter;
+
+	for (int remainder = 0; remainder < swingSpan; remainder++)
+	{
+		variation[v].swingTable[remainder] = swing(remainder, variation[v].swingValue, variation[v].swingQ);
+		jassert((variation[v].swingTable[remainder] >= 0) && (variation[v].swingTable[remainder] <= Topiary::TicksPerQuarter));
+	}
+
+	variation[v].swingTableValue = variation[v].swingValue;
+	variation[v].swingTableQ = variation[v].swingQ;
+
+} // rebuildSwingTable
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 void  TopiaryRiffzModel::generateAllVariations(int measureToGenerate)
 {
+	if (measureToGenerate == -1)
+	{
+		for (int v = 0; v < 8; v++)
+			markVariationDirty(v);
+		regenerateDirty();
+		return;
+	}
+
 	for (int v = 0; v < 8; v++)
 	{
 		if (variation[v].enabled)
@@ -1138,24 +1200,228 @@ void  TopiaryRiffzModel::generateAllVariations(int measureToGenerate)
 	}
 } // generateAllVariations()
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::rebuildPatternUsers(int v)
+{
+	// pattern -> variation dependencies, from the patternLookUp of variation v
+
+	for (int p = 0; p < MAXNOPATTERNS; p++)
+		patternUsers[p] &= (uint8) ~(1 << v);
+
+	for (int j = 0; j < MAXPATTERNSINVARIATION; j++)
+	{
+		int p = variation[v].patternLookUp[j].patternId;
+		if ((p >= 0) && (p < MAXNOPATTERNS))
+			patternUsers[p] |= (uint8) (1 << v);
+	}
+
+} // rebuildPatternUsers
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::markPatternDirty(int p)
+{
+	// only the slots that play pattern p, in the variations that use it
+
+	if ((p < 0) || (p >= MAXNOPATTERNS))
+		return;
+
+	for (int v = 0; v < 8; v++)
+	{
+		if (!(patternUsers[p] & (1 << v)))
+			continue;
+
+		for (int j = 0; j < MAXPATTERNSINVARIATION; j++)
+			if (variation[v].patternLookUp[j].patternId == p)
+				dirtySlots[v] |= (uint8) (1 << variation[v].patternLookUp[j].patternInVariationId);
+	}
+
+} // markPatternDirty
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::markVariationDirty(int v)
+{
+	for (int j = 0; j < MAXPATTERNSINVARIATION; j++)
+		if (variation[v].patternLookUp[j].patternInVariationId != -1)
+			dirtySlots[v] |= (uint8) (1 << variation[v].patternLookUp[j].patternInVariationId);
+
+} // markVariationDirty
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::regenerateDirty()
+{
+	// one full regeneration per dirty slot of an enabled variation; a plain render (see plainRender) is made once per
+	// source pattern, however many variations play it; inside an edit transaction this waits for the commit
+
+	if (editDepth > 0)
+		return;
+
+	flushingDirty = true;
+	plainRenderedInFlush = 0;
+
+	for (int v = 0; v < 8; v++)
+	{
+		uint8 slots = dirtySlots[v];
+		dirtySlots[v] = 0;
+
+		if (!variation[v].enabled)
+			continue; // marks of a disabled variation are dropped; enabling it regenerates it
+
+		for (int s = 0; s < MAXPATTERNSINVARIATION; s++)
+			if (slots & (1 << s))
+				generateVariation(v, s, -1);
+	}
+
+	flushingDirty = false;
+
+} // regenerateDirty
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzModel::hasRandomization(int v)
+{
+	// swing on its own is deterministic, so a single render will do
+	return variation[v].randomizeNotes || variation[v].randomizeVelocity || variation[v].randomizeTiming || variation[v].randomizeLength;
+
+} // hasRandomization
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzModel::isPlain(int v)
+{
+	return !hasRandomization(v) && !variation[v].swing;
+
+} // isPlain
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzPatternBuffer* TopiaryRiffzModel::playBuffer(int v, int slot)
+{
+	// a shared render is acquired by whichever variation plays it; on a switch between two plain variations the incoming
+	// acquire retires what the outgoing cursor reads, and releaseRetiredPatterns keeps it until that cursor moved on
+
+	int source = variation[v].plainSource[slot].get();
+	if (source == -1)
+		return &(variation[v].pattern[slot]);
+
+	return &(plainRender[source]);
+
+} // playBuffer
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzModel::usesTakes(int v)
+{
+	return variation[v].enabled && hasRandomization(v) && (variation[v].numTakes > 0);
+
+} // usesTakes
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::setNumTakes(int v, int n)
+{
+	variation[v].numTakes = jlimit(0, TopiaryRiffzPatternBuffer::maxTakes, n);
+
+} // setNumTakes
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzModel::getNumTakes(int v)
+{
+	return variation[v].numTakes;
+
+} // getNumTakes
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::setRandomSeed(int v, int seed)
+{
+	variation[v].randomSeed = seed;
+	generateVariation(v, -1);
+
+} // setRandomSeed
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzModel::getRandomSeed(int v)
+{
+	return variation[v].randomSeed;
+
+} // getRandomSeed
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::renderTakes()
+{
+	// message thread; render at most one take per pattern per call so we never hog the message thread
+
+	for (int v = 0; v < 8; v++)
+	{
+		int takes = usesTakes(v) ? variation[v].numTakes : 0;
+
+		for (int p = 0; p < MAXPATTERNSINVARIATION; p++)
+		{
+			int patternInVariation = variation[v].patternLookUp[p].patternInVariationId;
+			if (patternInVariation == -1)
+				continue;
+
+			TopiaryRiffzPatternBuffer* buffer = &(variation[v].pattern[patternInVariation]);
+			buffer->setNumTakes(takes);
+			buffer->trim(variation[v].plainSource[patternInVariation].get() == -1); // a slot playing the shared plain render needs no spare
+
+			if ((takes > 0) && (buffer->getNumTakesNeeded() > 0))
+				generateVariation(v, patternInVariation, -1, true);
+		}
+	}
+
+	for (int p = 0; p < MAXNOPATTERNS; p++)
+		plainRender[p].trim();
+
+} // renderTakes
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::prepareVariationSwitch()
+{
+	// message thread; as soon as a switch is requested, render (and publish) whatever the target variation has never had rendered
+	// so that at the quantized boundary maintainParentPattern (see enterVariationPatterns) only has to swap pointers
+
+	int target = variationSelected;
+	if (target == variationRunning)
+	{
+		preparedVariation = -1;
+		return;
+	}
+
+	if ((target < 0) || (target > 7) || (target == preparedVariation))
+		return;
+
+	for (int p = 0; p < MAXPATTERNSINVARIATION; p++)
+	{
+		int patternInVariation = variation[target].patternLookUp[p].patternInVariationId;
+		if (patternInVariation == -1)
+			continue;
+
+		if ((variation[target].plainSource[patternInVariation].get() == -1) && !variation[target].pattern[patternInVariation].hasPublished())
+			generateVariation(target, patternInVariation, -1);
+	}
+
+	preparedVariation = target;
+
+} // prepareVariationSwitch
+
 ////////////////////////////////////////////////////////////////////////////////////
 // move to modelincludes when done
 
 void TopiaryRiffzModel::regenerateVariationsForPattern(int p)
 {
-	// regenerate the variations using this pattern
+	// regenerate the variations using this pattern; only the slots playing it
 
-	for (int v = 0; v < 8; v++)
-	{
-		if (variation[v].enabled)
-			for (int pat = 0; pat < MAXPATTERNSINVARIATION; pat++)
-			
-				if (variation[v].patternLookUp[pat].patternId == p)
-				{
-					generateVariation(v, variation[v].patternLookUp[pat].patternId, -1);
-					pat = MAXPATTERNSINVARIATION;  // otherwise if the pattern is used multiple time, we regenerate multiple time - not needed
-				}
-	} 
+	markPatternDirty(p);
+	regenerateDirty();
 
 } // regenerateVariationsForPattern
 
@@ -1169,59 +1435,41 @@ void TopiaryRiffzModel::setPatternLength(int p, int l, bool keepTail)
 	bool warned = false;
 
 	int newLenInTicks = l * Topiary::TicksPerQuarter * denominator;
-	int tickDelta = patternData[p].patLenInTicks - newLenInTicks;
-	int measureDelta = tickDelta / (Topiary::TicksPerQuarter * denominator);
+	int tickDelta = patternData.read(p).patLenInTicks - newLenInTicks;
 
-	if (patternData[p].patLenInTicks != newLenInTicks)
+	if (patternData.read(p).patLenInTicks != newLenInTicks)
 	{
-		bool deleted;
-
-		for (int i=0; i<patternData[p].numItems; i++)
+		beginEdit();
 
+		// one compaction pass: shift (keepTail), clip lengths and drop what falls outside
+		int lost = TopiaryRiffzPatternEdit::apply(patternData[p], [&](auto& e)
 		{
-			deleted = false;
 			if (tickDelta >0) // only delete notes if the pattern gets shorter
-				if ( ((newLenInTicks <= patternData[p].dataList[i].timestamp) && !keepTail) ||
-					 (keepTail && (patternData[p].dataList[i].timestamp < tickDelta))  )
-				{
-					// flag to delete the event
-
-					warned = true;
-					deleted = true;
-				
-					if ((patternData[p].dataList[i].timestamp + patternData[p].dataList[i].length) > newLenInTicks)
-						patternData[p].dataList[i].length = patternData[p].dataList[i].length - patternData[p].dataList[i].timestamp;
-				}
+				if ( ((newLenInTicks <= e.timestamp) && !keepTail) ||
+					 (keepTail && (e.timestamp < tickDelta))  )
+					return false;
 
 			if (keepTail)
-			{
-				// correct measure, beat, tick & timestamps
-				patternData[p].dataList[i].timestamp = patternData[p].dataList[i].timestamp - tickDelta;
-				patternData[p].dataList[i].measure = patternData[p].dataList[i].measure - measureDelta;
-			}
+				e.timestamp = e.timestamp - tickDelta; // measure, beat and tick follow in refreshMBT
 
 			// make sure note length never runs over total patternlength
-			if (patternData[p].dataList[i].timestamp + patternData[p].dataList[i].length >= newLenInTicks)
-				patternData[p].dataList[i].length =  newLenInTicks - patternData[p].dataList[i].timestamp -1;
+			if (e.timestamp + e.length >= newLenInTicks)
+				e.length =  newLenInTicks - e.timestamp -1;
 
-			if (deleted)
-			{
-				patternData[p].del(i);
-				i--;
-			}
-		}
+			return true;
+		});
+
+		warned = (lost > 0);
 
 		patternData[p].patLenInTicks = newLenInTicks;
 		setPatternLengthInMeasures(p, l);  
-		patternData[p].sortByTimestamp();
+		// no sort needed: apply() keeps the order (keepTail moves every event by the same delta) and renumbers the IDs
 
-		// regenerate variations because we no longer know which variation used which pattern
-		for (int v = 0; v < 8; v++)
-			generateVariation(v, -1);
+		patternEdited(p, false);
+		commitEdit(); // MsgPattern, and regenerates the variations playing p
 
 		if (warned)
 			Log("Pattern was shortened and MIDI events were lost.", Topiary::LogType::Warning);
-		broadcaster.sendActionMessage(MsgPattern);
 		broadcaster.sendActionMessage(MsgPatternList);
 	}
 	
@@ -1229,14 +1477,66 @@ void TopiaryRiffzModel::setPatternLength(int p, int l, bool keepTail)
 
 ////////////////////////////////////////////////////////////////////////////////////
 
+void TopiaryRiffzModel::beginEdit()
+{
+	editDepth++;
+
+} // beginEdit
+
+////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::patternEdited(int p, bool needsSort)
+{
+	jassert(editDepth > 0); // pattern edits go through a transaction
+	jassert((p >= 0) && (p < MAXNOPATTERNS) && (MAXNOPATTERNS <= 32));
+
+	editedPatterns |= (uint32) 1 << p;
+	invalidateMBT(p);
+	if (needsSort)
+		unsortedPatterns |= (uint32) 1 << p;
+
+} // patternEdited
+
+////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::commitEdit()
+{
+	// only the outermost commit does the work: one sort per pattern added to, one MsgPattern, one regeneration per pattern
+
+	jassert(editDepth > 0);
+	if (--editDepth > 0)
+		return;
+
+	if (editedPatterns == 0)
+		return;
+
+	for (int p = 0; p < MAXNOPATTERNS; p++)
+		if (unsortedPatterns & ((uint32) 1 << p))
+			patternData[p].sortByTimestamp(); // will create the IDs
+
+	broadcaster.sendActionMessage(MsgPattern);
+
+	for (int p = 0; p < MAXNOPATTERNS; p++)
+		if (editedPatterns & ((uint32) 1 << p))
+			markPatternDirty(p);
+	regenerateDirty();
+
+	editedPatterns = 0;
+	unsortedPatterns = 0;
+
+} // commitEdit
+
+////////////////////////////////////////////////////////////////////////////////////
+
 void TopiaryRiffzModel::deleteNote(int p ,int n)
 {
 	// deletes note with ID n from pattern p
+	beginEdit();
 	patternData[p].del(n);
-	broadcaster.sendActionMessage(MsgPattern);
+	patternEdited(p, false);
+	commitEdit();
 
 	Log("Note deleted.", Topiary::LogType::Info);
-	regenerateVariationsForPattern(p);
 	
 } // deleteNote
 
@@ -1244,14 +1544,10 @@ void TopiaryRiffzModel::deleteNote(int p ,int n)
 
 void TopiaryRiffzModel::addNote(int p, int n, int v, int l, int timestamp) 
 {   
-	int measuree = (int)(timestamp / (denominator*Topiary::TicksPerQuarter));
-	int t = timestamp % (denominator*Topiary::TicksPerQuarter);
-	int beatt = (int)(t / Topiary::TicksPerQuarter);
-	t = t % Topiary::TicksPerQuarter;
-	patternData[p].addNote(measuree, beatt, t, timestamp, n, l, v);
-	patternData[p].sortByTimestamp(); // will create the ID
-	broadcaster.sendActionMessage(MsgPattern);
-	regenerateVariationsForPattern(p);
+	beginEdit();
+	patternData[p].addNote(0, 0, 0, timestamp, n, l, v);
+	patternEdited(p, true); // sorted (which creates the ID) at commit; measure, beat and tick are derived in refreshMBT
+	commitEdit();
 
 }  // addNote
 
@@ -1259,14 +1555,10 @@ void TopiaryRiffzModel::addNote(int p, int n, int v, int l, int timestamp)
 
 void TopiaryRiffzModel::addAT(int p, int at, int timestamp)
 {
-	int measuree = (int)(timestamp / (denominator * Topiary::TicksPerQuarter));
-	int t = timestamp % (denominator * Topiary::TicksPerQuarter);
-	int beatt = (int)(t / Topiary::TicksPerQuarter);
-	t = t % Topiary::TicksPerQuarter;
-	patternData[p].addAT(measuree, beatt, t, timestamp, at);
-	patternData[p].sortByTimestamp(); // will create the ID
-	broadcaster.sendActionMessage(MsgPattern);
-	regenerateVariationsForPattern(p);
+	beginEdit();
+	patternData[p].addAT(0, 0, 0, timestamp, at);
+	patternEdited(p, true); // sorted (which creates the ID) at commit; measure, beat and tick are derived in refreshMBT
+	commitEdit();
 
 }  // addAT
 
@@ -1274,14 +1566,10 @@ void TopiaryRiffzModel::addAT(int p, int at, int timestamp)
 
 void TopiaryRiffzModel::addCC(int p, int CC, int value, int timestamp)
 {
-	int measuree = (int)(timestamp / (denominator * Topiary::TicksPerQuarter));
-	int t = timestamp % (denominator * Topiary::TicksPerQuarter);
-	int beatt = (int)(t / Topiary::TicksPerQuarter);
-	t = t % Topiary::TicksPerQuarter;
-	patternData[p].addCC(measuree, beatt, t, timestamp, CC, value);
-	patternData[p].sortByTimestamp(); // will create the ID
-	broadcaster.sendActionMessage(MsgPattern);
-	regenerateVariationsForPattern(p);
+	beginEdit();
+	patternData[p].addCC(0, 0, 0, timestamp, CC, value);
+	patternEdited(p, true); // sorted (which creates the ID) at commit; measure, beat and tick are derived in refreshMBT
+	commitEdit();
 
 }  // addCC
 
@@ -1289,14 +1577,10 @@ void TopiaryRiffzModel::addCC(int p, int CC, int value, int timestamp)
 
 void TopiaryRiffzModel::addPitch(int p, int value, int timestamp)
 {
-	int measuree = (int)(timestamp / (denominator * Topiary::TicksPerQuarter));
-	int t = timestamp % (denominator * Topiary::TicksPerQuarter);
-	int beatt = (int)(t / Topiary::TicksPerQuarter);
-	t = t % Topiary::TicksPerQuarter;
-	patternData[p].addPitch(measuree, beatt, t, timestamp, value);
-	patternData[p].sortByTimestamp(); // will create the ID
-	broadcaster.sendActionMessage(MsgPattern);
-	regenerateVariationsForPattern(p);
+	beginEdit();
+	patternData[p].addPitch(0, 0, 0, timestamp, value);
+	patternEdited(p, true); // sorted (which creates the ID) at commit; measure, beat and tick are derived in refreshMBT
+	commitEdit();
 
 }  // addPitch
 
@@ -1306,12 +1590,13 @@ void TopiaryRiffzModel::addPitch(int p, int value, int timestamp)
 void TopiaryRiffzModel::getNote(int p, int ID, int& note, int &velocity, int &timestamp, int &length, int &midiType, int &value)  // get note with id ID from pattern p
 {
 	// get note with id ID from pattern p
-	note = patternData[p].dataList[ID].note;
-	velocity = patternData[p].dataList[ID].velocity;
-	length = patternData[p].dataList[ID].length;
-	timestamp = patternData[p].dataList[ID].timestamp;
-	midiType = patternData[p].dataList[ID].midiType;
-	value = patternData[p].dataList[ID].value;
+	const TopiaryPattern& pattern = patternData.read(p); // no copy on write just to look
+	note = pattern.dataList[ID].note;
+	velocity = pattern.dataList[ID].velocity;
+	length = pattern.dataList[ID].length;
+	timestamp = pattern.dataList[ID].timestamp;
+	midiType = pattern.dataList[ID].midiType;
+	value = pattern.dataList[ID].value;
 
 } // getNote
 
@@ -1319,48 +1604,20 @@ void TopiaryRiffzModel::getNote(int p, int ID, int& note, int &velocity, int &ti
 
 void TopiaryRiffzModel::deleteAllNotes(int p, int n)  // delete all notes equal to ID n from pattern
 {
-	// get note with id ID from pattern p
+	// deletes every event like the one with ID n: same note, same controller, or all pitch bend / aftertouch
 	
-	int note = patternData[p].dataList[n-1].note;
-	int midiType = patternData[p].dataList[n-1].midiType;
-	for (int i=0; i<patternData[p].numItems; i++)
-	{
-		switch (midiType)
-		{
-		case (Topiary::NoteOn):
-			if (patternData[p].dataList[i].note == note) 
-			{
-				// delete the child
-				patternData[p].del(i);
-				i--;
-			}
-			break;
-		case (Topiary::Pitch):
-			if (patternData[p].dataList[i].midiType == Topiary::Pitch) 
-			{
-				// delete the child
-				patternData[p].del(i);
-				i--;
-			}
-			break;
-		case (Topiary::CC):
-			if ((patternData[p].dataList[i].midiType == Topiary::CC)&&(patternData[p].dataList[i].note==note))
-			{
-				// delete the child
-				patternData[p].del(i);
-				i--;
-			}
-			break;
-		case (Topiary::AfterTouch):
-			if (patternData[p].dataList[i].midiType == Topiary::AfterTouch)
-			{
-				// delete the child
-				patternData[p].del(i);
-				i--;
-			}
-			break;
-		}
-	}
+	int note = patternData.read(p).dataList[n-1].note;
+	int midiType = patternData.read(p).dataList[n-1].midiType;
+
+	TopiaryRiffzPatternEdit::Filter filter;
+	filter.midiType = midiType;
+	if ((midiType == Topiary::NoteOn) || (midiType == Topiary::CC))
+		filter.note = note;
+
+	beginEdit();
+	TopiaryRiffzPatternEdit::removeMatching(patternData[p], filter);
+	patternEdited(p, false);
+	commitEdit();
 
 } // deleteAllNotes
 
@@ -1527,7 +1784,8 @@ void TopiaryRiffzModel::duplicatePattern(int p)
 	patternList.duplicate(p);
 	
 	// duplicate the patterndata
-	patternData[getNumPatterns() - 1].duplicate(&(patternData[p]));
+	patternData.duplicate(p, getNumPatterns() - 1); // shares the events until one of both is edited
+	invalidateMBT(getNumPatterns() - 1);
 
 	broadcaster.sendActionMessage(MsgPatternList);
 	Log("Duplicate pattern created.", Topiary::LogType::Info);
@@ -1541,8 +1799,10 @@ void TopiaryRiffzModel::clearPattern(int p)
 	jassert(p > -1); // has to be a valid row to delete
 	jassert(p < getNumPatterns());
 
+	beginEdit();
 	patternData[p].numItems = 0;
-	generateAllVariations(-1);
+	patternEdited(p, false);
+	commitEdit(); // regenerates only what plays pattern p
 
 	Log("Pattern cleared.", Topiary::LogType::Info);
 
@@ -1555,16 +1815,79 @@ TopiaryPattern* TopiaryRiffzModel::getPattern(int p)
 	jassert( (p < getNumPatterns()) || (p==0));
 	jassert(p >= 0);
 	
-	return &(patternData[p]);
+	refreshMBT(p); // the editor shows measure, beat and tick
+
+	// only shown: neither allocate storage for it nor unshare a duplicate
+	static TopiaryPattern none; // shown while p has no storage; never written
+	TopiaryPattern* pattern = patternData.getDerived(p);
+	return (pattern != nullptr) ? pattern : &none;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
+void TopiaryRiffzModel::refreshMBT(int p)
+{
+	// timestamp is what counts; measure, beat and tick are only derived for display (and saving),
+	// once per edit and time signature instead of on every edit
+
+	const int signature = (numerator << 8) | denominator;
+	if (mbtSignature[p] == signature)
+		return;
+
+	// only measure, beat and tick are written: no copy on write, no re-sort and no new IDs
+	auto pattern = patternData.getDerived(p);
+	if (pattern != nullptr)
+	{
+		for (int i = 0; i < pattern->numItems; i++)
+		{
+			auto& e = pattern->dataList[i];
+			timestampToMBT(e.timestamp, e.measure, e.beat, e.tick);
+		}
+	}
+
+	mbtSignature[p] = signature;
+
+} // refreshMBT
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::invalidateMBT(int p)
+{
+	if (p == -1)
+	{
+		for (int i = 0; i < MAXNOPATTERNS; i++)
+			mbtSignature[i] = 0;
+	}
+	else
+		mbtSignature[p] = 0;
+
+} // invalidateMBT
+
+///////////////////////////////////////////////////////////////////////////////////////
+
 void TopiaryRiffzModel::quantize(int p, int ticks)
 {
-	patternData[p].quantize(ticks);
-	for (int i=0; i<patternData[p].numItems; i++)
-		timestampToMBT(patternData[p].dataList[i].timestamp, patternData[p].dataList[i].measure, patternData[p].dataList[i].beat, patternData[p].dataList[i].tick);
+	// one transformMatching pass: every event snaps to the nearest multiple of ticks, staying inside the pattern
+	jassert(ticks > 0);
+
+	const int patLenInTicks = patternData.read(p).patLenInTicks;
+	TopiaryRiffzPatternEdit::Filter filter; // all events
+
+	beginEdit();
+	TopiaryRiffzPatternEdit::transformMatching(patternData[p], filter, [ticks, patLenInTicks](auto& e)
+	{
+		int timestamp = ((e.timestamp + (ticks / 2)) / ticks) * ticks;
+		if (timestamp >= patLenInTicks)
+			timestamp -= ticks;
+		e.timestamp = jmax(0, timestamp);
+
+		// make sure note length never runs over total patternlength (for CCs length is the controller)
+		if ((e.midiType == Topiary::NoteOn) && (e.timestamp + e.length >= patLenInTicks))
+			e.length = patLenInTicks - e.timestamp - 1;
+	});
+	patternEdited(p, false); // rounding never changes the order; measure, beat and tick are derived when shown
+	commitEdit();
+
 } // quantize
 
 ///////////////////////////////////////////////////////////////////////////////////////
@@ -1599,7 +1922,7 @@ void TopiaryRiffzModel::outputNoteOn(int noteNumber)
 {
 		const GenericScopedLock<CriticalSection> myScopedLock(lockModel);
 		MidiMessage msg = MidiMessage::noteOn(outputChannel, noteNumber, (float) 1.0);
-		modelEventBuffer.addEvent(msg, 0);
+		addMidiEvent(&modelEventBuffer, msg, 0);
 
 } // outputNoteOn
 
@@ -1609,17 +1932,48 @@ void TopiaryRiffzModel::outputNoteOff(int noteNumber)
 {
 		const GenericScopedLock<CriticalSection> myScopedLock(lockModel);
 		MidiMessage msg = MidiMessage::noteOff(outputChannel, noteNumber, (float) 1.0);
-		modelEventBuffer.addEvent(msg, 0);
+		addMidiEvent(&modelEventBuffer, msg, 0);
 	
 } // outputNoteOff  
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::prepareMidiBuffers(MidiBuffer* outputBuffer, int maxEventsPerBlock)
+{
+	midiArena.prepare(modelEventBuffer, maxEventsPerBlock);
+	if (outputBuffer != nullptr)
+		midiArena.prepare(*outputBuffer, maxEventsPerBlock);
+
+} // prepareMidiBuffers
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzModel::addMidiEvent(MidiBuffer* buffer, const MidiMessage& msg, int samplePosition)
+{
+	return midiArena.add(*buffer, msg, samplePosition);
+
+} // addMidiEvent
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzModel::getNumMidiOverflows()
+{
+	return midiArena.getNumOverflows();
+
+} // getNumMidiOverflows
+
 ///////////////////////////////////////////////////////////////////////////////////////
 
 void TopiaryRiffzModel::maintainParentPattern()
 {
 	//global var parentPattern depends on the variation that is running and the note that is playing.
+
+	// processVariationSwitch calls this right after it switched variations: the boundary the switch was prepared for
+	const bool entering = (variationRunning != enteredVariation);
+	if (entering)
+		enterVariationPatterns();
 	
 	// look up the note
-	auto noteList = &(variation[variationRunning].noteAssignmentList);
 	int notePlaying = keytracker.notePlaying;
 	if (notePlaying == -1)
 	{
@@ -1632,38 +1986,182 @@ void TopiaryRiffzModel::maintainParentPattern()
 	{
 		// should only happen when switching variations and note previously assigned now is not
 		parentPattern = nullptr;
+		parentSlot = -1;
 		return; // parentpattern should be nullptr or else it was what it was
 	}
 
-	int noteIndex = -1;
-	for (int i = 0; i < noteList->getNumItems(); i++) 
-		if (noteList->dataList[i].note == notePlaying)
-		{
-			noteIndex = i;
-			i = noteList->getNumItems();
-		}
+	int offset;
+	int vindex = findPatternSlot(variationRunning, notePlaying, offset);
 
-	if (noteIndex == -1)
+	if (vindex == -1)
 	{
 		// note is not assigned anything - we let stuff run as is
 		//if (!parentPattern) jassert(false);
 		return;
 	}
 
-	// now we look at the pattern for this note - this is the pattern in the source patternlist
-	int patternIndex = noteList->dataList[noteIndex].patternId;
+	TopiaryRiffzPatternBuffer* buffer = playBuffer(variationRunning, vindex);
+	if (buffer->acquire())
+		retiredPatterns = true;
+	parentPattern = buffer->getLive();
+	parentSlot = vindex;
+
+	releaseRetiredPatterns();
+
+}  // maintainParentPattern;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::enterVariationPatterns()
+{
+	// the new variation was rendered ahead by prepareVariationSwitch: making its patterns live is a pointer swap per slot
 
-	// now look up which pattern in the variation this is
 	for (int i = 0; i < MAXPATTERNSINVARIATION; i++)
-		if (variation[variationRunning].patternLookUp[i].patternId == patternIndex)
+		if (playBuffer(variationRunning, i)->acquire())
+			retiredPatterns = true;
+
+	enteredVariation = variationRunning;
+
+} // enterVariationPatterns
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzModel::findPatternSlot(int v, int note, int& offset)
+{
+	// one load from the dispatch table; safe on the audio thread while the editor rebuilds it
+
+	int entry = variation[v].noteDispatch[note & 127].get();
+	if (entry == 0)
+		return -1;
+
+	offset = (entry >> 8) - 0x8000;
+	return (entry & 0xFF) - 1;
+
+} // findPatternSlot
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::rebuildNoteDispatch(int v)
+{
+	// note -> (patternInVariationId, offset) for every note, from the note assignments and patternLookUp
+	// every entry is a single atomic word, so the audio thread always reads a complete (old or new) assignment
+
+	int entries[128];
+	for (int note = 0; note < 128; note++)
+		entries[note] = 0;
+
+	auto noteList = &(variation[v].noteAssignmentList);
+	for (int i = 0; i < noteList->getNumItems(); i++)
+	{
+		int note = noteList->dataList[i].note;
+		if ((note < 0) || (note > 127) || (entries[note] != 0))
+			continue; // first assignment of a note wins, as in the lookups this replaces
+
+		for (int j = 0; j < MAXPATTERNSINVARIATION; j++)
+			if (variation[v].patternLookUp[j].patternId == noteList->dataList[i].patternId)
+			{
+				jassert((noteList->dataList[i].offset > -0x8000) && (noteList->dataList[i].offset < 0x8000));
+				entries[note] = (variation[v].patternLookUp[j].patternInVariationId + 1) | ((noteList->dataList[i].offset + 0x8000) << 8);
+				break;
+			}
+
+		jassert(entries[note] != 0); // assigned pattern missing in patternLookUp
+	}
+
+	for (int note = 0; note < 128; note++)
+		variation[v].noteDispatch[note].set(entries[note]);
+
+} // rebuildNoteDispatch
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzModel::swapLivePatterns(bool nextTake, bool atLoopStart)
+{
+	// audio thread: make freshly regenerated patterns (or the next take) of the running variation live
+	// the cursor into parentPattern is an event index that only generateMidi can re-walk, so the slot parentPattern
+	// comes from only changes at the loop start, and only to a pattern with as many events (same source, so the
+	// index still points at the same note); anything else waits for maintainParentPattern, after which generateMidi does walk
+	// a slot can also move between its own render and the shared plain one (see playBuffer), hence the compare on parentSlot
+
+	bool parentChanged = false;
+
+	for (int i = 0; i < MAXPATTERNSINVARIATION; i++)
+	{
+		TopiaryRiffzPatternBuffer* buffer = playBuffer(variationRunning, i);
+		bool swapped = false;
+
+		if ((i == parentSlot) && (parentPattern != nullptr))
 		{
-			int vindex = variation[variationRunning].patternLookUp[i].patternInVariationId;
-			parentPattern = &(variation[variationRunning].pattern[vindex]);
-			return;
+			if (atLoopStart)
+				swapped = nextTake ? buffer->nextTake(parentPattern->numItems) : buffer->acquire(parentPattern->numItems);
 		}
+		else
+			swapped = nextTake ? buffer->nextTake() : buffer->acquire();
 
-	jassert(false);
-}  // maintainParentPattern;
+		if (swapped)
+			retiredPatterns = true;
+
+		if (buffer != &(variation[variationRunning].pattern[i]))
+		{
+			variation[variationRunning].pattern[i].retire(); // plays the shared render; renderTakes frees our own
+			retiredPatterns = true;
+		}
+
+		TopiaryRiffzGeneratedPattern* live = buffer->getLive();
+		if ((i == parentSlot) && (parentPattern != nullptr) && (live != nullptr) && (live != parentPattern)
+			&& atLoopStart && (live->numItems == parentPattern->numItems))
+		{
+			parentPattern = live;
+			parentChanged = true;
+		}
+	}
+
+	releaseRetiredPatterns();
+	return parentChanged;
+
+} // swapLivePatterns
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzModel::releaseRetiredPatterns()
+{
+	// a replaced pattern goes back to the generating thread only once no cursor points into it any more
+
+	if (!retiredPatterns)
+		return;
+
+	TopiaryRiffzGeneratedPattern* inUse = static_cast<TopiaryRiffzGeneratedPattern*>(parentPattern);
+
+	bool stillInUse = false;
+
+	for (int v = 0; v < 8; v++)
+		for (int i = 0; i < MAXPATTERNSINVARIATION; i++)
+			if (variation[v].pattern[i].releaseRetired(inUse))
+				stillInUse = true;
+
+	for (int p = 0; p < MAXNOPATTERNS; p++)
+		if (plainRender[p].releaseRetired(inUse))
+			stillInUse = true;
+
+	retiredPatterns = stillInUse;
+
+} // releaseRetiredPatterns
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzModel::acquireGeneratedPatterns(bool atLoopStart)
+{
+	return swapLivePatterns(false, atLoopStart);
+
+} // acquireGeneratedPatterns
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzModel::consumeNextTakes()
+{
+	return swapLivePatterns(true, true);
+
+} // consumeNextTakes
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -1702,15 +2200,10 @@ void TopiaryRiffzModel::record(bool b)
 void TopiaryRiffzModel::keytrack(int note)
 {
 	// only pass the note into keytracker if it has been assigned in the current variation
-	bool assigned = false;
+	int offset;
+	int vindex = findPatternSlot(variationRunning, note, offset);
 
-	for (int n=0; n< variation[variationRunning].noteAssignmentList.numItems; n++)
-		if (variation[variationRunning].noteAssignmentList.dataList[n].note == note)
-		{
-			assigned = true;
-			n = 10000;
-		}
-	if (assigned)
+	if (vindex != -1)
 		keytracker.push(note);
 
 } // keytrack
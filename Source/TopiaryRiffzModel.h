@@ -28,6 +28,12 @@ along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
 #include "../Topiary/Source/Components/TopiaryMidiLearnEditor.h"
 
 #include "NoteAssignmentList.h"
+#include "TopiaryRiffzPatternBuffer.h"
+#include "TopiaryRiffzRandom.h"
+#include "TopiaryRiffzKeytracker.h"
+#include "TopiaryRiffzMidiArena.h"
+#include "TopiaryRiffzPatternStore.h"
+#include "TopiaryRiffzPatternEdit.h"
 
 #define MAXPATTERNSINVARIATION 8
 
@@ -67,6 +73,9 @@ public:
 
 	void deleteAllNotes(int p, int n);  // deletes all occurrence of note n (id of event) in the pattern
 
+	void beginEdit();	// pattern edits until the matching commitEdit are sorted, announced and regenerated once; may nest
+	void commitEdit();	// IDs of events added inside the transaction are only valid after the outermost commit
+
 	void setLatch(bool l1, bool l2);
 	void getLatch(bool &l1, bool &l2); 
 	void setOutputChannel(int c);
@@ -122,11 +131,18 @@ public:
 	void setNoteOrder(int n);
 	int getNoteOrder();
 	int getNoteAssignmentNote();
+	void setNumTakes(int v, int n);
+	int getNumTakes(int v);
+	void setRandomSeed(int v, int seed);
+	int getRandomSeed(int v);
+	bool usesTakes(int v); // if true, the variation plays pre-rendered takes and needs no eighth regeneration while running
 
 
 	void generateVariation(int v, int measureToGenerate); // calls the next one below for all patterns
-	void generateVariation(int v, int p, int measureToGenerate); // Generates the variation;
+	void generateVariation(int v, int p, int measureToGenerate, bool asTake = false); // Generates the variation; asTake queues it as randomization take instead of replacing what plays
 	void generateAllVariations(int measureToGenerate);
+	void renderTakes(); // called by takeRenderer on the message thread; tops up the take pools
+	void prepareVariationSwitch(); // called by takeRenderer on the message thread; renders a pending target variation ahead of its switch
 
 	void setOverrideHostTransport(bool o) override;
 	void setNumeratorDenominator(int nu, int de) override;
@@ -147,7 +163,7 @@ public:
 	struct Variation {
 
 		int lenInMeasures;
-		TopiaryVariation pattern[MAXPATTERNSINVARIATION];			// pattern  events in the variation
+		TopiaryRiffzPatternBuffer pattern[MAXPATTERNSINVARIATION];		// pattern  events in the variation; regenerated in the back buffer, played from the live one
 		
 		int type;
 		bool ended;
@@ -182,8 +198,19 @@ public:
 		bool lengthMin;
 		int swingQ;
 
+		int swingTable[Topiary::TicksPerQuarter];	// swing() of every remainder, for swingTableValue and swingTableQ
+		int swingTableValue = -1;
+		int swingTableQ = -1;
+
+		int numTakes;	// number of pre-rendered randomization takes kept ready; a new take is played every loop
+
+		int randomSeed;	// humanization seed; same seed, same renders
+		int renderIteration[MAXPATTERNSINVARIATION];	// iteration the last full render (or take) of each pattern was seeded with; saved, so a reload renders the same
+
 		NoteAssignmentList noteAssignmentList;
 		PatternLookUp patternLookUp[MAXPATTERNSINVARIATION];  
+		Atomic<int> noteDispatch[128];	// per note: 0 if unassigned, else packed patternInVariationId and offset; see rebuildNoteDispatch
+		Atomic<int> plainSource[MAXPATTERNSINVARIATION];	// source pattern whose shared plain render the slot plays, -1 if it plays its own; see playBuffer
 	};
 
 	void swapVariation(int from, int to) override; 
@@ -194,9 +221,12 @@ public:
 
 	void processMidiRecording() override; // add recorded events to the pattern
 	void maintainParentPattern();
+	bool acquireGeneratedPatterns(bool atLoopStart); // audio thread, every eighth (see generateVariation): pick up regenerated patterns; returns true if parentPattern changed (see swapLivePatterns)
+	bool consumeNextTakes(); // audio thread, at the first eighth of a loop (see generateVariation): play the next randomization take; returns true if parentPattern changed (see swapLivePatterns)
 
 	TopiaryPatternList* getPatternList();
 	TopiaryPattern* getPattern(int p);
+	void refreshMBT(int p); // derive measure, beat and tick of pattern p if stale; call before showing them
 	int getNumPatterns();
 
 	bool walkToTick(TopiaryVariation* parent, int& childIndex, int toTick);
@@ -204,10 +234,15 @@ public:
 
 	void outputNoteOn(int noteNumber);
 	void outputNoteOff(int noteNumber);
+	void prepareMidiBuffers(MidiBuffer* outputBuffer, int maxEventsPerBlock = defaultMaxEventsPerBlock); // not on the audio thread; reserves room in modelEventBuffer and (if not nullptr) the output buffer
+	bool addMidiEvent(MidiBuffer* buffer, const MidiMessage& msg, int samplePosition); // never allocates in a prepared buffer, false (and counted) if it is full
+	int getNumMidiOverflows();
+
+	static const int defaultMaxEventsPerBlock = 2048;
 
 	void processPluginParameters();
 
-	TopiaryKeytracker keytracker;
+	TopiaryRiffzKeytracker keytracker;
 	TopiaryVariation* parentPattern; // maintained by void maintainParentattern in processvariationSwitch
 
 	void setLockState(bool state);
@@ -240,7 +275,7 @@ public:
 	
 private:
 	TopiaryPatternList patternList;
-	TopiaryPattern patternData[MAXNOPATTERNS];
+	TopiaryRiffzPatternStore patternData;	// patterns are allocated when first used, not MAXNOPATTERNS up front; indexes are handles
 	Variation variation[9];  	// struct to hold variation detail; variation 8 is used to record patterns in - not a real variation!
 	TopiaryNoteOffBuffer noteOffBuffer;
 	float prevRndNoteOccurrence;
@@ -258,6 +293,56 @@ private:
 	int outputChannel = 1;		// output of plugin
 	bool lockState = false;
 
+	int parentSlot = -1;		// audio thread; pattern[] slot parentPattern comes from
+	bool retiredPatterns = false;	// audio thread; some pattern buffer holds replaced patterns, see releaseRetiredPatterns
+
+	int editDepth = 0;			// beginEdit nesting (message thread)
+	uint32 editedPatterns = 0;	// bit p: pattern p changed in the open transaction
+	uint32 unsortedPatterns = 0;	// bit p: events were added to pattern p in the open transaction
+	void patternEdited(int p, bool needsSort);
+
+	int mbtSignature[MAXNOPATTERNS] = {};	// (numerator << 8) | denominator measure, beat and tick of pattern p were derived for; 0 if stale
+	void invalidateMBT(int p);				// -1: all patterns
+
+	// regeneration scheduler (message thread): full regenerations are marked dirty per pattern slot and done in one go
+	uint8 patternUsers[MAXNOPATTERNS] = {};		// bit v: variation v plays pattern p; derived from patternLookUp
+	uint8 dirtySlots[8] = {};					// bit s: variation[v].pattern[s] needs a full regeneration
+	bool flushingDirty = false;
+	uint32 plainRenderedInFlush = 0;			// bit p: plainRender[p] was rendered in the regeneration going on
+	void rebuildPatternUsers(int v);
+	void markPatternDirty(int p);
+	void markVariationDirty(int v);
+	void regenerateDirty();
+
+	TopiaryRiffzPatternBuffer plainRender[MAXNOPATTERNS];	// one render per source pattern, shared by every variation that plays it without humanization or swing
+
+	class TakeRenderer : public Timer
+	{
+	public:
+		TakeRenderer(TopiaryRiffzModel* m) : riffzModel(m) {}
+		void timerCallback() override { riffzModel->renderTakes(); riffzModel->prepareVariationSwitch(); }
+	private:
+		TopiaryRiffzModel* riffzModel;
+	};
+
+	TakeRenderer takeRenderer { this };
+	int preparedVariation = -1;	// message thread; pending switch target that prepareVariationSwitch already rendered
+	int enteredVariation = -1;	// audio thread; variation whose patterns maintainParentPattern made live
+	void enterVariationPatterns();
+
+	TopiaryRiffzMidiArena midiArena;		// room reserved for audio thread MIDI output; see prepareMidiBuffers
+
+	HeapBlock<float> generatorDraws;	// scratch for full regenerations (message thread only)
+	int generatorDrawsCapacity = 0;
+	bool swapLivePatterns(bool nextTake, bool atLoopStart);
+	void releaseRetiredPatterns(); // audio thread, once parentPattern points at what it plays now
+	void rebuildSwingTable(int v);
+	int findPatternSlot(int v, int note, int& offset); // pattern[] slot that plays note in variation v, -1 if unassigned
+	void rebuildNoteDispatch(int v);
+	bool hasRandomization(int v);
+	bool isPlain(int v); // no humanization, no swing: the generated pattern is a plain copy of the source
+	TopiaryRiffzPatternBuffer* playBuffer(int v, int slot); // where the audio thread finds what slot plays: its own render or the shared plain one
+
 	//////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "../Topiary/Source/Model/LoadMidiPattern.cpp.h"	
@@ -308,6 +393,9 @@ private:
 			}
 		}
 
+		rebuildNoteDispatch(v);
+		rebuildPatternUsers(v);
+
 	} // redoPatternLookup
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////
@@ -343,7 +431,13 @@ private:
 		// this one will have a series of <Pattern>
 		model->addChildElement(patternDataa);
 		for (int p = 0; p < patternList.numItems; p++)
-			patternData[p].addToModel(patternDataa);
+		{
+			refreshMBT(p);
+			TopiaryPattern* pattern = patternData.getDerived(p); // saving does not unshare duplicates
+			if (pattern == nullptr)
+				pattern = &(patternData[p]);
+			pattern->addToModel(patternDataa);
+		}
 
 		auto parameters = new XmlElement("Parameters");
 		model->addChildElement(parameters);
@@ -412,6 +506,10 @@ private:
 			
 
 			addToModel(parameters, variation[i].swingQ, "swingQ", i);
+			addToModel(parameters, variation[i].numTakes, "numTakes", i);
+			addToModel(parameters, variation[i].randomSeed, "randomSeed", i);
+			for (int j = 0; j < MAXPATTERNSINVARIATION; j++)
+				addToModel(parameters, variation[i].renderIteration[j], "renderIteration" + String(j), i);
 
 
 			auto noteAssignmentData = new XmlElement("noteAssignments");
@@ -436,6 +534,9 @@ private:
 		overrideHostTransport = true; // otherwise we might get very weird effects if the host were running
 		setRunState(Topiary::Stopped);
 
+		for (int v = 0; v < 8; v++)
+			variation[v].numTakes = 0; // sessions saved before takes existed play without them
+
 		auto child = model->getFirstChildElement();
 		jassert(child->getTagName().equalsIgnoreCase("PatternList"));
 		patternList.getFromModel(child);
@@ -453,6 +554,11 @@ private:
 			p++;
 		}
 
+		// patterns of the previous state beyond the ones loaded are gone
+		for (; p < MAXNOPATTERNS; p++)
+			patternData.release(p);
+		invalidateMBT(-1);
+
 		child = child->getNextElement();
 		bool rememberOverride = true; // we do not want to set that right away!
 		jassert(child->getTagName().equalsIgnoreCase("Parameters"));
@@ -475,7 +581,7 @@ private:
 
 						else if (parameterName.compare("switchVariation") == 0) switchVariation = parameter->getIntAttribute("Value");
 						else if (parameterName.compare("runStopQ") == 0) runStopQ = parameter->getIntAttribute("Value");
-						else if (parameterName.compare("noteOrder") == 0) keytracker.noteOrder = parameter->getIntAttribute("Value");
+						else if (parameterName.compare("noteOrder") == 0) keytracker.setNoteOrder(parameter->getIntAttribute("Value"));
 						else if (parameterName.compare("variationStartQ") == 0) variationStartQ = parameter->getIntAttribute("Value");
 						else if (parameterName.compare("name") == 0) name = parameter->getStringAttribute("Value");
 
@@ -527,6 +633,9 @@ private:
 						else if (parameterName.compare("lengthMin") == 0) variation[parameter->getIntAttribute("Index")].lengthMin = parameter->getBoolAttribute("Value");
 
 						else if (parameterName.compare("swingQ") == 0) variation[parameter->getIntAttribute("Index")].swingQ = parameter->getIntAttribute("Value");
+						else if (parameterName.compare("numTakes") == 0) variation[parameter->getIntAttribute("Index")].numTakes = jlimit(0, TopiaryRiffzPatternBuffer::maxTakes, parameter->getIntAttribute("Value"));
+						else if (parameterName.compare("randomSeed") == 0) variation[parameter->getIntAttribute("Index")].randomSeed = parameter->getIntAttribute("Value");
+						else if (parameterName.startsWith("renderIteration")) variation[parameter->getIntAttribute("Index")].renderIteration[jlimit(0, MAXPATTERNSINVARIATION - 1, parameterName.getTrailingIntValue())] = jmax(0, parameter->getIntAttribute("Value"));
 
 						// automation
 						else if (parameterName.compare("variationSwitch") == 0)  variationSwitch[parameter->getIntAttribute("Index")] = parameter->getIntAttribute("Value");
@@ -562,7 +671,7 @@ private:
 
 		} // foreach parameters
 
-		
+		keytracker.setLatch(latch1 || latch2);
 
 		// if there are no patterns; all variations need to be disabled!!!
 
@@ -614,7 +723,6 @@ private:
 		variation[i].lenInMeasures = 0;
 		for (int j = 0; j < MAXPATTERNSINVARIATION; j++)
 		{
-			variation[i].pattern[j].patLenInTicks = 0;
 			variation[i].patternLookUp[j].patternId = -1;
 			variation[i].patternLookUp[j].patternInVariationId = -1;
 		}
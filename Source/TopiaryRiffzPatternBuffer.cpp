@@ -0,0 +1,270 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TopiaryRiffzPatternBuffer.h"
+
+TopiaryRiffzPatternBuffer::TopiaryRiffzPatternBuffer()
+{
+	for (int i = 0; i < maxBuffers; i++)
+	{
+		state[i].set(Free);
+		sequence[i] = 0;
+	}
+
+} // TopiaryRiffzPatternBuffer
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzPatternBuffer::~TopiaryRiffzPatternBuffer()
+{
+} // ~TopiaryRiffzPatternBuffer
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzGeneratedPattern* TopiaryRiffzPatternBuffer::getLive()
+{
+	if (live == -1)
+		return nullptr;
+
+	return buffers[live].get();
+
+} // getLive
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzPatternBuffer::takeReady(bool newestGenerationOnly, int numItems)
+{
+	// pick the Ready buffer of the current generation with the lowest sequence number and make it live
+	// Ready buffers of older generations are left alone; the generating thread reclaims them
+	// if newestGenerationOnly, only do so if live is from an older generation (i.e. something was published)
+	// if numItems != -1, a buffer with another number of events is left Ready
+
+	const int g = generation.get();
+	const int liveState = (live == -1) ? -1 : state[live].get();
+
+	if (newestGenerationOnly && (liveState == makeState(Live, g)))
+		return false;
+
+	int found = -1;
+
+	for (int i = 0; i < maxBuffers; i++)
+	{
+		if (state[i].get() != makeState(Ready, g))
+			continue;
+
+		if ((found == -1) || (sequence[i] < sequence[found]))
+			found = i;
+	}
+
+	if (found == -1)
+		return false;
+
+	if (!state[found].compareAndSetBool(makeState(Live, g), makeState(Ready, g)))
+		return false; // generation moved on while we were looking; try again next time
+
+	if ((numItems != -1) && (buffers[found]->numItems != numItems))
+	{
+		state[found].set(makeState(Ready, g)); // ours while Live, so nobody claimed it meanwhile
+		return false;
+	}
+
+	if (live != -1)
+		state[live].set(makeState(Retired, 0));
+
+	live = found;
+	return true;
+
+} // takeReady
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzPatternBuffer::acquire(int numItems)
+{
+	return takeReady(true, numItems);
+
+} // acquire
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzPatternBuffer::nextTake(int numItems)
+{
+	return takeReady(false, numItems);
+
+} // nextTake
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternBuffer::retire()
+{
+	// stop playing the live buffer; releaseRetired() hands it back once no cursor points into it
+	// a later publish() becomes live again at the next acquire
+
+	if (live == -1)
+		return;
+
+	state[live].set(makeState(Retired, 0));
+	live = -1;
+
+} // retire
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzPatternBuffer::releaseRetired(TopiaryRiffzGeneratedPattern* inUse)
+{
+	// the generating thread reuses or frees (trim) what we release here
+
+	bool stillInUse = false;
+
+	for (int i = 0; i < maxBuffers; i++)
+	{
+		if (state[i].get() != makeState(Retired, 0))
+			continue;
+
+		if ((inUse != nullptr) && (inUse == buffers[i].get()))
+			stillInUse = true;
+		else
+			state[i].set(makeState(Free, 0));
+	}
+
+	return stillInUse;
+
+} // releaseRetired
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternBuffer::setNumTakes(int n)
+{
+	numTakes = jlimit(0, maxTakes, n);
+
+} // setNumTakes
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzPatternBuffer::getNumTakesNeeded()
+{
+	const int g = generation.get();
+	int ready = 0;
+
+	for (int i = 0; i < maxBuffers; i++)
+		if (state[i].get() == makeState(Ready, g))
+			ready++;
+
+	return jmax(0, numTakes - ready);
+
+} // getNumTakesNeeded
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzGeneratedPattern* TopiaryRiffzPatternBuffer::getBack()
+{
+	if (back != -1)
+		return buffers[back].get(); // still ours from a previous call that did not publish
+
+	const int g = generation.get();
+
+	for (int i = 0; i < maxBuffers; i++)
+	{
+		int s = state[i].get();
+		bool claimable = (s == makeState(Free, 0)) || (((s & 7) == Ready) && ((s >> 3) != g));
+
+		if (claimable && state[i].compareAndSetBool(makeState(Writing, 0), s))
+		{
+			back = i;
+			if (buffers[back] == nullptr)
+				buffers[back].reset(new TopiaryRiffzGeneratedPattern());
+
+			return buffers[back].get();
+		}
+	}
+
+	jassertfalse; // cannot happen: live + retired + published + numTakes <= maxBuffers - 1
+	return nullptr;
+
+} // getBack
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternBuffer::publish()
+{
+	jassert(back != -1);
+
+	// new generation: everything queued so far is outdated
+	const int g = (generation.get() + 1) & 0x0FFFFFFF;
+	generation.set(g);
+	sequence[back] = nextSequence++;
+	state[back].set(makeState(Ready, g));
+	back = -1;
+
+} // publish
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternBuffer::publishTake()
+{
+	jassert(back != -1);
+
+	sequence[back] = nextSequence++;
+	state[back].set(makeState(Ready, generation.get()));
+	back = -1;
+
+} // publishTake
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzPatternBuffer::hasPublished()
+{
+	return nextSequence > 0;
+
+} // hasPublished
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternBuffer::trim(bool keepSpare)
+{
+	// a generated pattern is big (room for MAXVARIATIONITEMS events); after the number of takes goes down,
+	// or takes of an outdated generation pile up, free what is not live, retired, queued or being written
+	// a buffer is claimed (Writing) before it is freed, so the audio thread never sees it go
+
+	const int g = generation.get();
+	bool spareKept = !keepSpare;
+
+	for (int i = 0; i < maxBuffers; i++)
+	{
+		if ((i == back) || (buffers[i] == nullptr))
+			continue;
+
+		int s = state[i].get();
+		bool unused = (s == makeState(Free, 0)) || (((s & 7) == Ready) && ((s >> 3) != g));
+		if (!unused)
+			continue;
+
+		if (!spareKept)
+		{
+			spareKept = true;
+			continue;
+		}
+
+		if (state[i].compareAndSetBool(makeState(Writing, 0), s))
+		{
+			buffers[i].reset();
+			state[i].set(makeState(Free, 0));
+		}
+	}
+
+} // trim
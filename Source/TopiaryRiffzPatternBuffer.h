@@ -0,0 +1,89 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "TopiaryRiffzGeneratedPattern.h"
+
+/*
+Pool of generated patterns for one pattern slot of a variation, so the editor can regenerate a
+pattern while the audio thread is playing it, and randomized takes can be rendered ahead of time.
+- the audio thread owns the live buffer; it plays it and regenerates eighths in it
+- the generating thread (the message thread) claims a free buffer with getBack(), renders into it and
+  hands it over with publish() (replaces live at the next acquire) or publishTake() (queued take,
+  played at the start of a coming loop)
+- every publish() starts a new generation; takes of older generations are never played again and
+  their buffers are reused
+- a live pattern that gets replaced is retired, not freed: cursors may still point into it. Once the
+  audio thread has moved them on, releaseRetired() hands it back to the generating thread
+Ownership of a buffer is passed by a compare-and-swap on its state, so neither side ever waits for
+the other. Buffers are only allocated (and freed, see trim) by the generating thread; getLive()
+returns nullptr until something has been published.
+*/
+
+class TopiaryRiffzPatternBuffer
+{
+public:
+	TopiaryRiffzPatternBuffer();
+	~TopiaryRiffzPatternBuffer();
+
+	static const int maxTakes = 8;
+
+	TopiaryRiffzGeneratedPattern* getLive();	// audio thread
+	bool acquire(int numItems = -1);			// audio thread; make the last publish() live; returns true if the live pattern changed
+	bool nextTake(int numItems = -1);			// audio thread, at loop start; make the oldest queued take live; returns true if the live pattern changed
+												// for both: if numItems != -1, only a pattern with that many events goes live, anything else stays queued
+	void retire();								// audio thread; stop playing the live pattern (another buffer plays this slot now)
+	bool releaseRetired(TopiaryRiffzGeneratedPattern* inUse);	// audio thread; free retired patterns other than inUse (where the cursor is); true if inUse is one of them
+
+	void setNumTakes(int n);					// generating thread; number of takes to keep queued
+	int getNumTakesNeeded();					// generating thread; how many takes are missing in the queue
+	TopiaryRiffzGeneratedPattern* getBack();	// generating thread; claims and if needed allocates a free buffer
+	void publish();								// generating thread
+	void publishTake();							// generating thread
+	bool hasPublished();						// generating thread; false until the first publish() or publishTake()
+	void trim(bool keepSpare = true);			// generating thread; frees buffers nobody needs, by default keeping one spare for the next render
+
+private:
+	enum State
+	{
+		Free = 0,
+		Writing = 1,
+		Ready = 2,
+		Live = 3,
+		Retired = 4		// was live; the audio thread may still be reading it
+	};
+
+	static const int maxBuffers = maxTakes + 4;	// live, retired, one being written, one published and the takes
+
+	std::unique_ptr<TopiaryRiffzGeneratedPattern> buffers[maxBuffers];
+	Atomic<int> state[maxBuffers];		// State | (generation << 3)
+	int sequence[maxBuffers];			// publish order; written before the buffer becomes Ready
+	Atomic<int> generation { 0 };
+
+	int live = -1;						// owned by audio thread
+	int back = -1;						// owned by generating thread
+	int numTakes = 0;					// owned by generating thread
+	int nextSequence = 0;				// owned by generating thread
+
+	int makeState(int s, int g) { return s | (g << 3); }
+	bool takeReady(bool newestGenerationOnly, int numItems);	// audio thread
+
+	JUCE_DECLARE_NON_COPYABLE(TopiaryRiffzPatternBuffer)
+
+}; // TopiaryRiffzPatternBuffer
@@ -210,6 +210,7 @@ ActionButtonsComponent::ActionButtonsComponent()
 	addAndMakeVisible(quantizeButton);
 	quantizeButton.setSize(bW, bH);
 	quantizeButton.setButtonText("Quantize");
+	quantizeButton.setTooltip("Snap every event to the nearest step; an event that would land on the pattern end moves one step back. The variations playing the pattern are regenerated.");
 	quantizeButton.onClick = [this]
 	{
 		parent->quantize();
@@ -104,6 +104,8 @@ void TopiaryRiffzPatternComponent::actionListenerCallback(const String &message)
 	else if (message.compare(MsgPattern) == 0)
 	{
 		// pattern (may have) changed; update the table
+		// fetch the pattern again: an edit can move it to other storage (a duplicate that got its own copy)
+		patternTable.setModel(riffzModel->getPattern(jmax(0, patternCombo.getSelectedId() - 1)));
 		int rememberSelectedRow = patternTable.getSelectedRow();
 		patternTable.updateContent();
 		patternTable.selectRow(rememberSelectedRow);
@@ -134,19 +136,24 @@ void TopiaryRiffzPatternComponent::actionListenerCallback(const String &message)
 			this->setEnabled(true);
 			if (patternCombo.getNumItems() > rememberPatternComboSelection)
 			{
-				patternCombo.setSelectedId(rememberPatternComboSelection+1);
+				patternCombo.setSelectedId(rememberPatternComboSelection+1, dontSendNotification);
 			}
 			else
 			{
-				patternCombo.setSelectedId(1);
+				patternCombo.setSelectedId(1, dontSendNotification);
 			}
 
+			// always, also if the selection did not change: deleting or swapping patterns moves them to other storage
+			processPatternCombo();
+
 			//actionListenerCallback(MsgPattern);  // force reload of patterndata
 		}
 		else
 		{
 			this->setEnabled(false);
 			patternCombo.setSelectedItemIndex(0, dontSendNotification);
+			patternTable.setModel(riffzModel->getPattern(0)); // the one shown may have been freed
+			patternTable.updateContent();
 		}
 		// fill the combobox with the pattern names
 	}
@@ -0,0 +1,92 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "TopiaryRiffz.h"
+#include "../Topiary/Source/Model/TopiaryPattern.h"
+
+/*
+Bulk edits of a pattern in one compaction pass. TopiaryPattern::del() shifts the rest of the list
+down for every event deleted, so deleting k events costs k passes; apply() visits every event once,
+lets the edit change it, and moves the ones kept into place as it goes. IDs are renumbered (1..n in
+list order) in the same pass; the order of the events is kept, so a sorted pattern stays sorted as
+long as the edit does not move timestamps.
+*/
+
+class TopiaryRiffzPatternEdit
+{
+public:
+	struct Filter
+	{
+		int midiType = -1;			// Topiary::NoteOn, CC, Pitch or AfterTouch; -1 matches any
+		int note = -1;				// note number, or controller number for CC; -1 matches any
+		int tickFrom = INT_MIN;		// timestamps in [tickFrom, tickTo)
+		int tickTo = INT_MAX;
+
+		template <typename Event>
+		bool matches(const Event& e) const
+		{
+			return ((midiType == -1) || (e.midiType == midiType))
+				&& ((note == -1) || (e.note == note))
+				&& (e.timestamp >= tickFrom) && (e.timestamp < tickTo);
+		}
+	};
+
+	// edit(event) may change the event; returning false deletes it; returns the number deleted
+	template <typename Edit>
+	static int apply(TopiaryPattern& pattern, Edit edit)
+	{
+		int kept = 0;
+
+		for (int i = 0; i < pattern.numItems; i++)
+		{
+			if (!edit(pattern.dataList[i]))
+				continue;
+
+			if (kept != i)
+				pattern.dataList[kept] = pattern.dataList[i];
+			pattern.dataList[kept].ID = kept + 1;
+			kept++;
+		}
+
+		int deleted = pattern.numItems - kept;
+		pattern.numItems = kept;
+		return deleted;
+
+	} // apply
+
+	static int removeMatching(TopiaryPattern& pattern, const Filter& filter)
+	{
+		return apply(pattern, [&filter](const auto& e) { return !filter.matches(e); });
+
+	} // removeMatching
+
+	template <typename Transform>
+	static void transformMatching(TopiaryPattern& pattern, const Filter& filter, Transform transform)
+	{
+		apply(pattern, [&filter, &transform](auto& e)
+		{
+			if (filter.matches(e))
+				transform(e);
+			return true;
+		});
+
+	} // transformMatching
+
+}; // TopiaryRiffzPatternEdit
@@ -0,0 +1,203 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TopiaryRiffzPatternStore.h"
+
+TopiaryRiffzPatternStore::TopiaryRiffzPatternStore()
+{
+	for (int s = 0; s < MAXNOPATTERNS; s++)
+	{
+		refCount[s] = 0;
+		handle[s].set(-1);
+	}
+
+} // TopiaryRiffzPatternStore
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryRiffzPatternStore::~TopiaryRiffzPatternStore()
+{
+} // ~TopiaryRiffzPatternStore
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternStore::setModel(TopiaryModel* m)
+{
+	model = m;
+	for (int s = 0; s < MAXNOPATTERNS; s++)
+		if (storage[s] != nullptr)
+			storage[s]->setModel(m);
+
+} // setModel
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzPatternStore::allocate()
+{
+	// every pattern index holds at most one storage, so there is always one free
+
+	for (int s = 0; s < MAXNOPATTERNS; s++)
+		if (refCount[s] == 0)
+		{
+			if (storage[s] == nullptr)
+				storage[s].reset(new TopiaryPattern());
+
+			storage[s]->numItems = 0;
+			if (model != nullptr)
+				storage[s]->setModel(model);
+
+			refCount[s] = 1;
+			return s;
+		}
+
+	jassertfalse;
+	return -1;
+
+} // allocate
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryPattern& TopiaryRiffzPatternStore::operator[](int p)
+{
+	jassert((p >= 0) && (p < MAXNOPATTERNS));
+
+	int s = handle[p].get();
+
+	if (s == -1)
+	{
+		s = allocate();
+		handle[p].set(s);
+	}
+	else if (refCount[s] > 1)
+	{
+		// shared with a duplicate; about to be changed, so it gets its own copy now
+		int copy = allocate();
+		*storage[copy] = *storage[s];
+		refCount[s]--;
+		handle[p].set(copy);
+		s = copy;
+	}
+
+	return *storage[s];
+
+} // operator[]
+
+/////////////////////////////////////////////////////////////////////////////
+
+const TopiaryPattern& TopiaryRiffzPatternStore::read(int p)
+{
+	static TopiaryPattern empty; // never written
+
+	int s = ((p >= 0) && (p < MAXNOPATTERNS)) ? handle[p].get() : -1;
+	if (s == -1)
+		return empty;
+
+	return *storage[s];
+
+} // read
+
+/////////////////////////////////////////////////////////////////////////////
+
+TopiaryPattern* TopiaryRiffzPatternStore::getDerived(int p)
+{
+	// no allocation and no unsharing: whatever is derived from the events is the same for every pattern sharing them
+
+	int s = ((p >= 0) && (p < MAXNOPATTERNS)) ? handle[p].get() : -1;
+	if (s == -1)
+		return nullptr;
+
+	return storage[s].get();
+
+} // getDerived
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool TopiaryRiffzPatternStore::exists(int p)
+{
+	return (p >= 0) && (p < MAXNOPATTERNS) && (handle[p].get() != -1);
+
+} // exists
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternStore::release(int p)
+{
+	jassert((p >= 0) && (p < MAXNOPATTERNS));
+
+	int s = handle[p].get();
+	if (s == -1)
+		return;
+
+	handle[p].set(-1);
+	if (--refCount[s] == 0)
+		storage[s].reset();
+
+} // release
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternStore::remove(int p)
+{
+	release(p);
+
+	for (int q = p; q < (MAXNOPATTERNS - 1); q++)
+		handle[q].set(handle[q + 1].get());
+	handle[MAXNOPATTERNS - 1].set(-1);
+
+} // remove
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternStore::duplicate(int from, int to)
+{
+	jassert(from != to);
+
+	release(to);
+
+	int s = handle[from].get();
+	if (s == -1)
+		return;
+
+	refCount[s]++;
+	handle[to].set(s);
+
+} // duplicate
+
+/////////////////////////////////////////////////////////////////////////////
+
+void TopiaryRiffzPatternStore::swap(int a, int b)
+{
+	int s = handle[a].get();
+	handle[a].set(handle[b].get());
+	handle[b].set(s);
+
+} // swap
+
+/////////////////////////////////////////////////////////////////////////////
+
+int TopiaryRiffzPatternStore::getNumAllocated()
+{
+	int n = 0;
+	for (int s = 0; s < MAXNOPATTERNS; s++)
+		if (storage[s] != nullptr)
+			n++;
+
+	return n;
+
+} // getNumAllocated
@@ -0,0 +1,64 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "TopiaryRiffz.h"
+#include "../Topiary/Source/Model/TopiaryPattern.h"
+
+/*
+Storage of the source patterns. A TopiaryPattern holds room for its maximum number of events, so
+instead of keeping MAXNOPATTERNS of them per instance whether used or not, a pattern is only
+allocated when it is first used and freed again when it leaves the pattern list.
+Pattern indexes are handles: handle[p] says which storage pattern p lives in. Deleting or swapping
+patterns only moves handles (deleting moves up to MAXNOPATTERNS handles, not the events), so
+anything holding on to a pattern must fetch it again after that. A duplicate shares its original's
+storage until one of them is changed through operator[] (copy on write).
+Allocation and copying happen on the message thread (adding, duplicating, editing, loading
+patterns), and so does all reading; the audio thread works from the snapshot every generated
+pattern takes of its source (see TopiaryRiffzGeneratedPattern::indexSourcePattern).
+*/
+
+class TopiaryRiffzPatternStore
+{
+public:
+	TopiaryRiffzPatternStore();
+	~TopiaryRiffzPatternStore();
+
+	void setModel(TopiaryModel* m);
+	TopiaryPattern& operator[](int p);		// pattern p, to change it: allocated on first use, unshared if it shares storage
+	const TopiaryPattern& read(int p);		// pattern p, to read it; an empty pattern if p has no storage
+	TopiaryPattern* getDerived(int p);		// message thread; pattern p to show, save or write fields derived from its events (shared storage included), nullptr if none
+	bool exists(int p);
+	void release(int p);					// message thread; pattern p is no longer in the pattern list
+	void remove(int p);						// pattern p is deleted; the ones behind it move up one index: O(MAXNOPATTERNS) handle moves
+	void duplicate(int from, int to);		// to becomes a copy of from, sharing its storage until either one changes
+	void swap(int a, int b);
+	int getNumAllocated();
+
+private:
+	std::unique_ptr<TopiaryPattern> storage[MAXNOPATTERNS];
+	int refCount[MAXNOPATTERNS];			// number of patterns in storage[s]
+	Atomic<int> handle[MAXNOPATTERNS];		// pattern index -> storage, -1 if none
+	TopiaryModel* model = nullptr;
+
+	int allocate();							// free storage; -1 if none (cannot happen)
+
+	JUCE_DECLARE_NON_COPYABLE(TopiaryRiffzPatternStore)
+
+}; // TopiaryRiffzPatternStore
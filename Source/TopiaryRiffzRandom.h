@@ -0,0 +1,59 @@
+/////////////////////////////////////////////////////////////////////////////
+/*
+This file is part of Topiary Riffz, Copyright Tom Tollenaere 2018-21.
+
+Topiary Riffz is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Topiary Riffz is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Topiary Riffz. If not, see <https://www.gnu.org/licenses/>.
+*/
+/////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "TopiaryRiffz.h"
+
+/*
+Counter based random numbers for humanization (SplitMix64 finalizer over seed, stream and counter).
+Draw number n of a given seed and stream is always the same value, whatever was drawn before, so
+renders are reproducible, eighths can be regenerated in any order, and draws for a whole pattern can
+be produced in one batch.
+*/
+
+class TopiaryRiffzRandom
+{
+public:
+	TopiaryRiffzRandom(int64 seed, int64 stream)
+	{
+		key = mix(mix((uint64)seed) ^ ((uint64)stream * 0xD1B54A32D192ED03ULL));
+	}
+
+	float getFloat(int64 counter)	// in [0, 1)
+	{
+		return (float)(mix(key + (uint64)counter * 0x9E3779B97F4A7C15ULL) >> 40) * (1.0f / 16777216.0f);
+	}
+
+	void fillFloats(float* dest, int n, int64 firstCounter)
+	{
+		for (int i = 0; i < n; i++)
+			dest[i] = getFloat(firstCounter + i);
+	}
+
+	static uint64 mix(uint64 z)
+	{
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+private:
+	uint64 key;
+
+}; // TopiaryRiffzRandom